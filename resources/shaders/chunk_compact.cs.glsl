@@ -0,0 +1,56 @@
+#version 460 core
+
+// Promotes each chunk's next rect to its current rect and its later rect to its next rect, adds
+// pending modifications and appends chunks with work to the active list that drives the indirect
+// simulation dispatch.
+
+layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+#include "sim_common.glsl"
+
+void main() {
+    // every chunk of every world, the active list mixes them
+    int i = int(gl_GlobalInvocationID.x);
+    if (i >= num_chunks_x * num_chunks_y * num_worlds) {
+        return;
+    }
+    int local = enter_world(i);
+    ivec2 grid_size = ivec2(grid_size_x, grid_size_y);
+    ivec2 chunk_min = ivec2(local % num_chunks_x, local / num_chunks_x) * CHUNK_SIZE;
+    ivec2 chunk_max = min(chunk_min + CHUNK_SIZE, grid_size) - 1;
+
+    ivec2 rect_min = ivec2(chunks[i].next_min_x, chunks[i].next_min_y);
+    ivec2 rect_max = ivec2(chunks[i].next_max_x, chunks[i].next_max_y);
+    uint bin_count = modification_count > 0 ? mod_bins[2 * i + 1] : 0u;
+    for (uint m = 0; m < bin_count; m++) {
+        ivec2 mod_min;
+        ivec2 mod_max;
+        modification_bounds(modifications[mod_bins[mod_bins[2 * i] + m]], mod_min, mod_max);
+        if (block_offset >= 0 && all(lessThanEqual(mod_min, mod_max))) {
+            align_to_blocks(mod_min, mod_max, block_offset);
+        }
+        mod_min = max(mod_min, chunk_min);
+        mod_max = min(mod_max, chunk_max);
+        if (all(lessThanEqual(mod_min, mod_max))) {
+            rect_min = min(rect_min, mod_min);
+            rect_max = max(rect_max, mod_max);
+        }
+    }
+
+    chunks[i].min_x = rect_min.x;
+    chunks[i].min_y = rect_min.y;
+    chunks[i].max_x = rect_max.x;
+    chunks[i].max_y = rect_max.y;
+    chunks[i].next_min_x = chunks[i].later_min_x;
+    chunks[i].next_min_y = chunks[i].later_min_y;
+    chunks[i].next_max_x = chunks[i].later_max_x;
+    chunks[i].next_max_y = chunks[i].later_max_y;
+    chunks[i].later_min_x = EMPTY_MIN;
+    chunks[i].later_min_y = EMPTY_MIN;
+    chunks[i].later_max_x = EMPTY_MAX;
+    chunks[i].later_max_y = EMPTY_MAX;
+    if (all(lessThanEqual(rect_min, rect_max))) {
+        uint slot = atomicAdd(num_groups_x, 1u);
+        active_chunks[slot] = uint(i);
+    }
+}
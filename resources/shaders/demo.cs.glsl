@@ -2,19 +2,15 @@
 
 layout(local_size_x = WORK_GROUP_X, local_size_y = WORK_GROUP_Y, local_size_z = 1) in;
 
-layout(r32ui, binding = 0) uniform uimage2D img_input;
-layout(r32ui, binding = 1) uniform uimage2D img_output;
+#include "sim_common.glsl"
 
-uniform int grid_size_x;
-uniform int grid_size_y;
-uniform int modification_count = 0;
+// CELL_FORMAT is the texture format, r8ui or r32ui. Either way a texel holds one packed cell.
+layout(CELL_FORMAT, binding = 0) uniform CELL_IMAGE img_input;
+layout(CELL_FORMAT, binding = 1) uniform CELL_IMAGE img_output;
 
-const int MAT_None = 0;
-const int MAT_Sand = 1;
-const int MAT_Water = 2;
-
-uint Pack(int material_type) {
-    return material_type;
+// Must match CellData::Pack in Cell.hpp: material in the low 4 bits, color index in the high 4.
+uint Pack(int material_type, uint color_index) {
+    return uint(material_type) | (color_index << 4);
 }
 
 uint get_data(ivec2 pos, ivec2 offset);
@@ -25,78 +21,154 @@ const ivec2 right = ivec2(1, 0);
 const ivec2 left = ivec2(-1, 0);
 const ivec2 none = ivec2(0, 0);
 
-struct Cell {
-    int material;
-};
+// Rows the rules read below and above a cell. Must match Rules.hpp.
+const int REACH_BELOW = 2;
+const int REACH_ABOVE = 1;
 
-uint SHAPE_Circle = 0;
-uint SHAPE_Square = 1;
-struct Modification {
-    ivec2 pos;
-    float radius;
-    uint shape;
-    int material;
-};
+// Bit lower of SINKS[upper] is set when material upper sinks into material lower, see kSinks in
+// Material.hpp.
+const uint SINKS[16] = uint[](MATERIAL_SINKS);
 
-layout(std430, binding = 0) readonly buffer ModBuffer {
-    Modification modifications[];
+bool sinks(int upper, int lower) {
+    return ((SINKS[upper] >> lower) & 1u) != 0u;
+}
+
+struct Cell {
+    int material;
+    uint color_index;
 };
 
 Cell new_cell(uint data);
 
 Cell simulate(ivec2 pos);
 
-bool is_inside_circle(ivec2 pos, ivec2 circle_pos, float radius) {
-    return (pos.x - circle_pos.x) * (pos.x - circle_pos.x) + (pos.y - circle_pos.y) * (pos.y - circle_pos.y) < radius;
+#ifdef TILED
+// Every cell of the work group plus the cells the rules reach beyond it, loaded from img_input
+// once so the rules read neighbors from shared memory instead of issuing an imageLoad each.
+const int TILE_X = WORK_GROUP_X + 2;
+const int TILE_Y = WORK_GROUP_Y + REACH_BELOW + REACH_ABOVE;
+shared uint tile[TILE_Y][TILE_X];
+// grid position of tile[0][0]
+ivec2 tile_origin;
+
+void load_tile(ivec2 group_origin) {
+    tile_origin = group_origin - ivec2(1, REACH_BELOW);
+    for (int i = int(gl_LocalInvocationIndex); i < TILE_X * TILE_Y; i += WORK_GROUP_X * WORK_GROUP_Y) {
+        ivec2 tile_pos = ivec2(i % TILE_X, i / TILE_X);
+        ivec2 pos = tile_origin + tile_pos;
+        bool in_grid = all(greaterThanEqual(pos, ivec2(0))) && all(lessThan(pos, ivec2(grid_size_x, grid_size_y)));
+        tile[tile_pos.y][tile_pos.x] = in_grid ? imageLoad(img_input, CELL_COORD(pos)).r : 0u;
+    }
 }
+#endif
 
 void set_cell(ivec2 pos, Cell cell) {
-    imageStore(img_output, pos, ivec4(Pack(cell.material), 0, 0, 0));
+    imageStore(img_output, CELL_COORD(pos), uvec4(Pack(cell.material, cell.color_index), 0, 0, 0));
+}
+
+// bounds of the cells this work group changed, used to wake chunks for the next tick
+shared int changed_min_x;
+shared int changed_min_y;
+shared int changed_max_x;
+shared int changed_max_y;
+
+// Only the modifications binned to this cell's chunk can touch it.
+Cell update_cell(ivec2 pos, uint bin_offset, uint bin_count) {
+    for (uint i = 0; i < bin_count; i++) {
+        Modification modification = modifications[mod_bins[bin_offset + i]];
+        if (modification.shape == SHAPE_Circle) {
+            if (is_inside_circle(pos, modification.pos, modification.radius)) {
+                return new_cell(modification.material);
+            }
+        } else {}
+    }
+    return simulate(pos);
 }
 
 void main() {
-    ivec2 pos = ivec2(gl_GlobalInvocationID.xy);
-    if (pos.x >= grid_size_x || pos.y >= grid_size_y || pos.x < 0 || pos.y < 0) {
+    // one indirect work group row per awake chunk of any world, gl_WorkGroupID.y selects the tile
+    // in the chunk
+    int chunk_index = int(active_chunks[gl_WorkGroupID.x]);
+    int local_chunk = enter_world(chunk_index);
+    ivec2 chunk_pos = ivec2(local_chunk % num_chunks_x, local_chunk / num_chunks_x);
+    int group_index = int(gl_WorkGroupID.y);
+    ivec2 group_pos = ivec2(group_index % groups_per_chunk_x, group_index / groups_per_chunk_x);
+    ivec2 group_origin = chunk_pos * CHUNK_SIZE + group_pos * ivec2(WORK_GROUP_X, WORK_GROUP_Y);
+    ivec2 pos = group_origin + ivec2(gl_LocalInvocationID.xy);
+
+    // the whole group leaves together when it misses the chunk's dirty rect
+    Chunk chunk = chunks[chunk_index];
+    ivec2 group_max = group_origin + ivec2(WORK_GROUP_X, WORK_GROUP_Y) - 1;
+    if (group_origin.x > chunk.max_x || group_origin.y > chunk.max_y || group_max.x < chunk.min_x || group_max.y < chunk.min_y) {
         return;
     }
 
-    for (int i = 0; i < modification_count; i++) {
-        if (modifications[i].shape == SHAPE_Circle) {
-            if (is_inside_circle(pos, modifications[i].pos, modifications[i].radius)) {
-                Cell c = new_cell(modifications[i].material);
-                set_cell(pos, c);
-                return;
-            }
-        } else {}
+    // the bins are only bound for batches with modifications
+    uint bin_offset = modification_count > 0 ? mod_bins[2 * chunk_index] : 0u;
+    uint bin_count = modification_count > 0 ? mod_bins[2 * chunk_index + 1] : 0u;
+
+#ifdef TILED
+    load_tile(group_origin);
+#endif
+    if (gl_LocalInvocationIndex == 0) {
+        changed_min_x = EMPTY_MIN;
+        changed_min_y = EMPTY_MIN;
+        changed_max_x = EMPTY_MAX;
+        changed_max_y = EMPTY_MAX;
     }
+    barrier();
+
+    bool in_rect = pos.x >= chunk.min_x && pos.y >= chunk.min_y && pos.x <= chunk.max_x && pos.y <= chunk.max_y;
+    if (in_rect && pos.x < grid_size_x && pos.y < grid_size_y) {
+        Cell cell = update_cell(pos, bin_offset, bin_count);
+        set_cell(pos, cell);
+        if (Pack(cell.material, cell.color_index) != get_data(none, pos)) {
+            atomicMin(changed_min_x, pos.x);
+            atomicMin(changed_min_y, pos.y);
+            atomicMax(changed_max_x, pos.x);
+            atomicMax(changed_max_y, pos.y);
+        }
+    }
+    barrier();
 
-    Cell cell = simulate(pos);
-    set_cell(pos, cell);
+    // a cell can only change next tick if a cell within reach of the rules changed this tick,
+    // must match WakeRect in Rules.hpp
+    if (gl_LocalInvocationIndex == 0 && changed_max_x != EMPTY_MAX) {
+        mark_chunks_dirty(ivec2(changed_min_x, changed_min_y) - ivec2(1, REACH_ABOVE),
+            ivec2(changed_max_x, changed_max_y) + ivec2(1, REACH_BELOW), false);
+    }
 }
 
+// Must match SimulateCell in Rules.hpp. A cell swaps with the one below it when it sinks into it,
+// unless that one is itself swapping further down this tick, so no cell takes part in two swaps.
 Cell simulate(ivec2 pos) {
     Cell cell = new_cell(get_data(none, pos));
+    Cell cell_below = pos.y > 0 ? new_cell(get_data(down, pos)) : Cell(MAT_None, 0u);
+    bool cell_sinks = pos.y > 0 && sinks(cell.material, cell_below.material);
     if (pos.y < grid_size_y - 1) {
         Cell cell_above = new_cell(get_data(up, pos));
-        if (cell_above.material == MAT_Sand && cell.material == MAT_None) {
-            cell.material = MAT_Sand;
-            return cell;
+        if (!cell_sinks && sinks(cell_above.material, cell.material)) {
+            return cell_above;
         }
     }
-    if (pos.y > 0) {
-        Cell cell_below = new_cell(get_data(down, pos));
-        if (cell_below.material == MAT_None && cell.material != MAT_None) {
-            cell.material = MAT_None;
-            return cell;
+    if (cell_sinks) {
+        bool below_sinks = pos.y > 1 && sinks(cell_below.material, new_cell(get_data(2 * down, pos)).material);
+        if (!below_sinks) {
+            return cell_below;
         }
     }
     return cell;
 }
 
 uint get_data(ivec2 pos, ivec2 offset) {
-    return imageLoad(img_input, pos + offset).r;
+#ifdef TILED
+    ivec2 tile_pos = pos + offset - tile_origin;
+    return tile[tile_pos.y][tile_pos.x];
+#else
+    return imageLoad(img_input, CELL_COORD(pos + offset)).r;
+#endif
 }
 
 Cell new_cell(uint data) {
-    return Cell(data);
+    return Cell(int(bitfieldExtract(data, 0, 4)), bitfieldExtract(data, 4, 4));
 }
@@ -0,0 +1,199 @@
+#version 460 core
+
+// One Margolus pass. Each invocation rearranges one 2x2 block of cells, so no two invocations
+// touch the same cell and moves need no atomics. Must match SimulateChunkMargolus in CpuSim.cpp.
+
+layout(local_size_x = WORK_GROUP_X, local_size_y = WORK_GROUP_Y, local_size_z = 1) in;
+
+#include "sim_common.glsl"
+
+// CELL_FORMAT is the texture format, r8ui or r32ui. Either way a texel holds one packed cell.
+layout(CELL_FORMAT, binding = 0) uniform CELL_IMAGE img_input;
+layout(CELL_FORMAT, binding = 1) uniform CELL_IMAGE img_output;
+
+// Per material bit masks and fluidity, see kSinks, kSpreads and kFluidity in Material.hpp.
+const uint SINKS[16] = uint[](MATERIAL_SINKS);
+const uint SPREADS[16] = uint[](MATERIAL_SPREADS);
+const uint FLUIDITY[16] = uint[](MATERIAL_FLUIDITY);
+
+#ifdef BATCHED
+#define fluidity(material) world_params[world].fluidity[material]
+#else
+#define fluidity(material) FLUIDITY[material]
+#endif
+
+// Stands in for cells outside the grid, see kOutsideCell in Rules.hpp.
+const uint OUTSIDE_CELL = 0xfu;
+
+// bottom left, bottom right, top left, top right
+const ivec2 BLOCK_CELLS[4] = ivec2[](ivec2(0, 0), ivec2(1, 0), ivec2(0, 1), ivec2(1, 1));
+
+bool sinks(uint upper, uint lower) {
+    return ((SINKS[upper & 0xfu] >> (lower & 0xfu)) & 1u) != 0u;
+}
+
+bool spreads(uint from, uint to) {
+    return ((SPREADS[from & 0xfu] >> (to & 0xfu)) & 1u) != 0u;
+}
+
+void swap_cells(inout uint cells[4], int a, int b) {
+    uint tmp = cells[a];
+    cells[a] = cells[b];
+    cells[b] = tmp;
+}
+
+// Must match SimulateBlock in Rules.hpp. Returns true if a cell passed up a sideways move on its
+// roll, which has to keep the block awake.
+bool simulate_block(inout uint cells[4], uint random) {
+    bool moved[4] = bool[](false, false, false, false);
+    // straight down
+    for (int column = 0; column < 2; column++) {
+        if (sinks(cells[column + 2], cells[column])) {
+            swap_cells(cells, column + 2, column);
+            moved[column] = true;
+            moved[column + 2] = true;
+        }
+    }
+    // diagonally down past a lighter cell, which piles granular materials at 45 degrees
+    if (!moved[0] && !moved[1]) {
+        for (int column = 0; column < 2; column++) {
+            int other = 1 - column;
+            if (sinks(cells[column + 2], cells[other]) && sinks(cells[column + 2], cells[other + 2])) {
+                swap_cells(cells, column + 2, other);
+                moved[column + 2] = true;
+                moved[other] = true;
+                break;
+            }
+        }
+    }
+    // sideways within a row, one random byte per row
+    bool pending = false;
+#if ANY_FLUID
+    for (int row = 0; row < 4; row += 2) {
+        if (moved[row] || moved[row + 1]) {
+            continue;
+        }
+        uint from;
+        if (spreads(cells[row], cells[row + 1])) {
+            from = cells[row];
+        } else if (spreads(cells[row + 1], cells[row])) {
+            from = cells[row + 1];
+        } else {
+            continue;
+        }
+        if (((random >> (row * 4)) & 0xffu) < fluidity(from & 0xfu)) {
+            swap_cells(cells, row, row + 1);
+        } else {
+            pending = true;
+        }
+    }
+#endif
+    return pending;
+}
+
+bool in_grid(ivec2 pos) {
+    return all(greaterThanEqual(pos, ivec2(0))) && all(lessThan(pos, ivec2(grid_size_x, grid_size_y)));
+}
+
+// bounds of the cells this work group changed, used to wake chunks for the next passes
+shared int changed_min_x;
+shared int changed_min_y;
+shared int changed_max_x;
+shared int changed_max_y;
+
+void main() {
+    // one indirect work group row per awake chunk of any world, gl_WorkGroupID.y selects the tile
+    // of blocks
+    int chunk_index = int(active_chunks[gl_WorkGroupID.x]);
+    int local_chunk = enter_world(chunk_index);
+    ivec2 chunk_pos = ivec2(local_chunk % num_chunks_x, local_chunk / num_chunks_x);
+    int group_index = int(gl_WorkGroupID.y);
+    ivec2 group_pos = ivec2(group_index % groups_per_chunk_x, group_index / groups_per_chunk_x);
+    // A chunk owns the blocks whose top right cell it holds, clamped to the grid, so its blocks
+    // start one cell to the left and below it for offset 1. They may write into the chunks there.
+    // The clamp gives the last chunk column and row one more block when the grid ends on a chunk
+    // edge, see GroupsPerChunk.
+    ivec2 group_block = group_pos * ivec2(WORK_GROUP_X, WORK_GROUP_Y);
+    ivec2 group_min = chunk_pos * CHUNK_SIZE + 2 * group_block - block_offset;
+    ivec2 block = group_block + ivec2(gl_LocalInvocationID.xy);
+    ivec2 block_min = chunk_pos * CHUNK_SIZE + 2 * block - block_offset;
+    ivec2 chunk_max = chunk_pos * CHUNK_SIZE + CHUNK_SIZE - 1;
+    ivec2 grid_max = ivec2(grid_size_x, grid_size_y) - 1;
+
+    // the whole group leaves together when its blocks miss the chunk's dirty rect or belong to
+    // the next chunk
+    Chunk chunk = chunks[chunk_index];
+    ivec2 group_max = group_min + 2 * ivec2(WORK_GROUP_X, WORK_GROUP_Y) - 1;
+    if (group_min.x > chunk.max_x || group_min.y > chunk.max_y || group_max.x < chunk.min_x || group_max.y < chunk.min_y ||
+        any(greaterThan(min(group_min + 1, grid_max), chunk_max))) {
+        return;
+    }
+
+    if (gl_LocalInvocationIndex == 0) {
+        changed_min_x = EMPTY_MIN;
+        changed_min_y = EMPTY_MIN;
+        changed_max_x = EMPTY_MAX;
+        changed_max_y = EMPTY_MAX;
+    }
+    barrier();
+
+    ivec2 block_max = block_min + 1;
+    bool in_rect = all(lessThanEqual(min(block_max, grid_max), chunk_max)) &&
+        block_max.x >= chunk.min_x && block_max.y >= chunk.min_y && block_min.x <= chunk.max_x && block_min.y <= chunk.max_y;
+    if (in_rect) {
+        uint input_cells[4];
+        for (int i = 0; i < 4; i++) {
+            ivec2 pos = block_min + BLOCK_CELLS[i];
+            input_cells[i] = in_grid(pos) ? imageLoad(img_input, CELL_COORD(pos)).r : OUTSIDE_CELL;
+        }
+        uint cells[4] = input_cells;
+        // must match PassSeed in Rules.hpp
+        uint pass_seed = seed;
+#ifdef BATCHED
+        pass_seed ^= hash(world_params[world].seed);
+#endif
+        bool pending = simulate_block(cells, random_bits(pass_seed, block_min));
+        for (int i = 0; i < 4; i++) {
+            ivec2 pos = block_min + BLOCK_CELLS[i];
+            if (!in_grid(pos)) {
+                continue;
+            }
+            if (modification_count > 0) {
+                // the bin of the chunk holding the cell, which may not be this block's chunk
+                ivec2 cell_chunk = pos / CHUNK_SIZE;
+                int bin = world_chunk_base + cell_chunk.y * num_chunks_x + cell_chunk.x;
+                uint bin_offset = mod_bins[2 * bin];
+                uint bin_count = mod_bins[2 * bin + 1];
+                for (uint m = 0; m < bin_count; m++) {
+                    Modification modification = modifications[mod_bins[bin_offset + m]];
+                    if (modification.shape == SHAPE_Circle && is_inside_circle(pos, modification.pos, modification.radius)) {
+                        cells[i] = uint(modification.material);
+                        break;
+                    }
+                }
+            }
+            imageStore(img_output, CELL_COORD(pos), uvec4(cells[i], 0, 0, 0));
+            if (pending || cells[i] != input_cells[i]) {
+                atomicMin(changed_min_x, pos.x);
+                atomicMin(changed_min_y, pos.y);
+                atomicMax(changed_max_x, pos.x);
+                atomicMax(changed_max_y, pos.y);
+            }
+        }
+    }
+    barrier();
+
+    // A block can only change if one of its cells changed since the last pass with the same
+    // offset, so changed cells wake the blocks around them for both offsets. Must match
+    // CpuSim::StepMargolus.
+    if (gl_LocalInvocationIndex == 0 && changed_max_x != EMPTY_MAX) {
+        ivec2 next_min = ivec2(changed_min_x, changed_min_y);
+        ivec2 next_max = ivec2(changed_max_x, changed_max_y);
+        align_to_blocks(next_min, next_max, 1 - block_offset);
+        mark_chunks_dirty(next_min, next_max, false);
+        ivec2 later_min = ivec2(changed_min_x, changed_min_y);
+        ivec2 later_max = ivec2(changed_max_x, changed_max_y);
+        align_to_blocks(later_min, later_max, block_offset);
+        mark_chunks_dirty(later_min, later_max, true);
+    }
+}
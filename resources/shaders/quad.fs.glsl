@@ -6,17 +6,17 @@ out vec4 o_Color;
 
 uniform usampler2D tex;
 
-const vec3 MaterialToColor[3] = {
-        vec3(0),
-        vec3(1, 1, 0),
-        vec3(0, 0, 1),
-    };
+// NUM_MATERIALS and MATERIAL_COLOR come from MaterialDefines in Material.hpp
+const vec3 MaterialToColor[NUM_MATERIALS] = vec3[](MATERIAL_COLOR);
 
 void main() {
     uvec4 texel = texture(tex, TexCoord);
     uint value = texel.r;
-    // uint material_type = bitfieldExtract(value, 4, 4);
-    uint material_type = value;
+    // matches CellData::Pack: material in the low 4 bits, color index in the high 4
+    uint material_type = min(bitfieldExtract(value, 0, 4), uint(NUM_MATERIALS - 1));
+    uint color_index = bitfieldExtract(value, 4, 4);
+    // the color index darkens the material color slightly so neighboring cells can differ
+    float shade = 1.0 - float(color_index) / 32.0;
 
-    o_Color = vec4(MaterialToColor[material_type], 1.0);
+    o_Color = vec4(MaterialToColor[material_type] * shade, 1.0);
 }
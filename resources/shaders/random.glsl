@@ -0,0 +1,31 @@
+// Stateless counter-based random numbers. Every value is a hash of a seed and a counter, such as
+// a cell position, so invocations never share state and a rerun draws the same values. Must
+// match Random.hpp, see there.
+
+// Integer hash from https://github.com/skeeto/hash-prospector. hash(0) is 0.
+uint hash(uint x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// 32 random bits for counter under seed.
+uint random_bits(uint seed, uint counter) {
+    return hash(counter ^ hash(seed));
+}
+
+// 32 random bits for the cell or block at pos under seed.
+uint random_bits(uint seed, ivec2 pos) {
+    return hash(uint(pos.x) ^ hash(uint(pos.y) ^ hash(seed)));
+}
+
+// Maps random bits to [0, n), the high word of bits * n.
+uint random_below(uint bits, uint n) {
+    uint high;
+    uint low;
+    umulExtended(bits, n, high, low);
+    return high;
+}
@@ -0,0 +1,166 @@
+// Declarations shared by the simulation compute shaders. Expects CHUNK_SIZE and the material
+// defines from MaterialDefines in Material.hpp to be defined. With BATCHED defined, the cell
+// images are texture arrays with one layer per world of a BatchSim, and every buffer indexed by
+// chunk holds the chunks of all worlds one world after another.
+
+#include "random.glsl"
+
+uint SHAPE_Circle = 0;
+uint SHAPE_Square = 1;
+struct Modification {
+    ivec2 pos;
+    float radius;
+    uint shape;
+    int material;
+    int world;
+};
+
+// Parameters of one pass, written by SandSim once per batch for every pass of it. std140 so the
+// layout is fixed, must match SimParams in SandSim.cpp.
+layout(std140, binding = 0) uniform SimParams {
+    int grid_size_x;
+    int grid_size_y;
+    int num_chunks_x;
+    int num_chunks_y;
+    int groups_per_chunk_x;
+    // modifications to apply this pass, only nonzero on the first pass of a batch
+    int modification_count;
+    // blocks of the Margolus pass start at cells where x + block_offset and y + block_offset are
+    // even, -1 for the gather kernel
+    int block_offset;
+    // tick * 2 + pass, seeds the Margolus sideways rolls
+    uint seed;
+    // low 32 bits of the tick
+    uint tick;
+    // worlds of a BatchSim, 1 otherwise
+    int num_worlds;
+};
+
+layout(std430, binding = 0) readonly buffer ModBuffer {
+    Modification modifications[];
+};
+
+// An (offset, count) pair per chunk indexing into this same array, followed by the modification
+// indices of every chunk's bin in submission order. Built by ModificationBins in Chunk.hpp.
+layout(std430, binding = 3) readonly buffer ModBinBuffer {
+    uint mod_bins[];
+};
+
+// Rects are inclusive cell bounds, empty when max < min.
+struct Chunk {
+    // cells to simulate this tick
+    int min_x;
+    int min_y;
+    int max_x;
+    int max_y;
+    // cells to simulate next tick, grown with atomics while simulating
+    int next_min_x;
+    int next_min_y;
+    int next_max_x;
+    int next_max_y;
+    // cells to simulate the tick after next, only used by the Margolus passes
+    int later_min_x;
+    int later_min_y;
+    int later_max_x;
+    int later_max_y;
+};
+
+layout(std430, binding = 1) buffer ChunkBuffer {
+    Chunk chunks[];
+};
+
+// Indirect dispatch arguments for the simulation pass followed by the compacted list of awake chunks.
+layout(std430, binding = 2) buffer ActiveChunkBuffer {
+    uint num_groups_x;
+    uint num_groups_y;
+    uint num_groups_z;
+    uint active_chunks[];
+};
+
+// World of the chunk being simulated and the index of its first chunk, set by each kernel's
+// main(). Always 0 without BATCHED.
+int world = 0;
+int world_chunk_base = 0;
+
+#ifdef BATCHED
+#define CELL_IMAGE uimage2DArray
+#define CELL_COORD(pos) ivec3(pos, world)
+
+// Per world rule parameters, must match GpuWorldParams in BatchSim.cpp.
+struct WorldParams {
+    uint seed;
+    uint fluidity[16];
+};
+
+layout(std430, binding = 5) readonly buffer WorldParamsBuffer {
+    WorldParams world_params[];
+};
+#else
+#define CELL_IMAGE uimage2D
+#define CELL_COORD(pos) (pos)
+#endif
+
+// Points world and world_chunk_base at the world of a chunk index and returns the index of the
+// chunk within its world.
+int enter_world(int chunk_index) {
+    int chunks_per_world = num_chunks_x * num_chunks_y;
+    world = chunk_index / chunks_per_world;
+    world_chunk_base = world * chunks_per_world;
+    return chunk_index - world_chunk_base;
+}
+
+const int EMPTY_MIN = 0x7fffffff;
+const int EMPTY_MAX = -1;
+
+bool is_inside_circle(ivec2 pos, ivec2 circle_pos, float radius) {
+    return (pos.x - circle_pos.x) * (pos.x - circle_pos.x) + (pos.y - circle_pos.y) * (pos.y - circle_pos.y) < radius;
+}
+
+// Cells a modification can write to. Must match ModificationBounds in Chunk.hpp.
+void modification_bounds(Modification modification, out ivec2 min_pos, out ivec2 max_pos) {
+    if (modification.shape != SHAPE_Circle || modification.radius <= 0) {
+        min_pos = ivec2(EMPTY_MIN);
+        max_pos = ivec2(EMPTY_MAX);
+        return;
+    }
+    int extent = int(ceil(sqrt(modification.radius)));
+    min_pos = modification.pos - ivec2(extent);
+    max_pos = modification.pos + ivec2(extent);
+}
+
+// Grows [min_pos, max_pos] to whole Margolus blocks, which start at cells where x + offset and
+// y + offset are even. Must match AlignToBlocks in Rules.hpp.
+void align_to_blocks(inout ivec2 min_pos, inout ivec2 max_pos, int offset) {
+    min_pos -= (min_pos + offset) & 1;
+    max_pos += (max_pos + offset + 1) & 1;
+}
+
+// Grows the next rect, or the later rect, of every chunk overlapping [min_pos, max_pos].
+void mark_chunks_dirty(ivec2 min_pos, ivec2 max_pos, bool later) {
+    min_pos = max(min_pos, ivec2(0));
+    max_pos = min(max_pos, ivec2(grid_size_x, grid_size_y) - 1);
+    if (any(lessThan(max_pos, min_pos))) {
+        return;
+    }
+    ivec2 first = min_pos / CHUNK_SIZE;
+    ivec2 last = max_pos / CHUNK_SIZE;
+    for (int y = first.y; y <= last.y; y++) {
+        for (int x = first.x; x <= last.x; x++) {
+            int i = world_chunk_base + y * num_chunks_x + x;
+            ivec2 chunk_min = ivec2(x, y) * CHUNK_SIZE;
+            ivec2 clipped_min = max(min_pos, chunk_min);
+            ivec2 clipped_max = min(max_pos, chunk_min + CHUNK_SIZE - 1);
+            if (later) {
+                atomicMin(chunks[i].later_min_x, clipped_min.x);
+                atomicMin(chunks[i].later_min_y, clipped_min.y);
+                atomicMax(chunks[i].later_max_x, clipped_max.x);
+                atomicMax(chunks[i].later_max_y, clipped_max.y);
+            } else {
+                atomicMin(chunks[i].next_min_x, clipped_min.x);
+                atomicMin(chunks[i].next_min_y, clipped_min.y);
+                atomicMax(chunks[i].next_max_x, clipped_max.x);
+                atomicMax(chunks[i].next_max_y, clipped_max.y);
+            }
+        }
+    }
+}
@@ -0,0 +1,73 @@
+#version 460 core
+
+// Counts the cells of every material in the latest grid and the cells the last pass changed,
+// with the bounds of those changes. Each work group reduces its cells in shared memory first, so
+// the stats buffer only sees one atomic per counter per group.
+
+layout(local_size_x = 16, local_size_y = 16, local_size_z = 1) in;
+
+// CELL_FORMAT is the texture format, r8ui or r32ui. Either way a texel holds one packed cell.
+layout(CELL_FORMAT, binding = 0) readonly uniform uimage2D img_latest;
+layout(CELL_FORMAT, binding = 1) readonly uniform uimage2D img_previous;
+
+// Must match GpuStats in SandSim.cpp. SandSim clears it to zero counts and empty bounds first.
+layout(std430, binding = 4) buffer StatsBuffer {
+    uint material_counts[16];
+    uint changed_cells;
+    int changed_min_x;
+    int changed_min_y;
+    int changed_max_x;
+    int changed_max_y;
+};
+
+// Same as in sim_common.glsl
+const int EMPTY_MIN = 0x7fffffff;
+const int EMPTY_MAX = -1;
+
+shared uint group_counts[16];
+shared uint group_changed;
+shared int group_min_x;
+shared int group_min_y;
+shared int group_max_x;
+shared int group_max_y;
+
+void main() {
+    uint index = gl_LocalInvocationIndex;
+    if (index < 16u) {
+        group_counts[index] = 0u;
+    }
+    if (index == 0u) {
+        group_changed = 0u;
+        group_min_x = EMPTY_MIN;
+        group_min_y = EMPTY_MIN;
+        group_max_x = EMPTY_MAX;
+        group_max_y = EMPTY_MAX;
+    }
+    barrier();
+
+    ivec2 pos = ivec2(gl_GlobalInvocationID.xy);
+    if (all(lessThan(pos, imageSize(img_latest)))) {
+        uint cell = imageLoad(img_latest, pos).r;
+        // the material is in the low 4 bits, see CellData::Pack in Cell.hpp
+        atomicAdd(group_counts[cell & 0xfu], 1u);
+        if (cell != imageLoad(img_previous, pos).r) {
+            atomicAdd(group_changed, 1u);
+            atomicMin(group_min_x, pos.x);
+            atomicMin(group_min_y, pos.y);
+            atomicMax(group_max_x, pos.x);
+            atomicMax(group_max_y, pos.y);
+        }
+    }
+    barrier();
+
+    if (index < 16u && group_counts[index] != 0u) {
+        atomicAdd(material_counts[index], group_counts[index]);
+    }
+    if (index == 0u && group_changed != 0u) {
+        atomicAdd(changed_cells, group_changed);
+        atomicMin(changed_min_x, group_min_x);
+        atomicMin(changed_min_y, group_min_y);
+        atomicMax(changed_max_x, group_max_x);
+        atomicMax(changed_max_y, group_max_y);
+    }
+}
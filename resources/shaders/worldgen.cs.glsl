@@ -0,0 +1,78 @@
+#version 460 core
+
+// Fills both cell textures from a WorldGenDesc, see WorldGen.hpp, so a board never has to be
+// built on the CPU and uploaded. One invocation per cell.
+
+layout(local_size_x = 16, local_size_y = 16, local_size_z = 1) in;
+
+// CELL_FORMAT is the texture format, r8ui or r32ui. Either way a texel holds one packed cell.
+layout(CELL_FORMAT, binding = 0) writeonly uniform uimage2D img_prev;
+layout(CELL_FORMAT, binding = 1) writeonly uniform uimage2D img_curr;
+
+const uint KIND_STRATA = 1u;
+const uint KIND_TERRAIN = 2u;
+const uint KIND_SCATTER = 3u;
+
+// std140, must match GpuWorldGenParams in SandSim.cpp. kFill never gets here, it is a clear.
+layout(std140, binding = 1) uniform WorldGenParams {
+    uint kind;
+    uint material;
+    uint seed;
+    uint density;
+    int base_height;
+    int amplitude;
+    int feature_size;
+    uint fluid;
+    int fluid_level;
+    int num_layers;
+    // material, y_begin, y_end, unused
+    ivec4 layers[8];
+};
+
+#include "random.glsl"
+
+// Must match ValueNoise in WorldGen.hpp
+int value_noise(int x, int period, int noise_amplitude, uint noise_seed) {
+    uint range = uint(2 * noise_amplitude + 1);
+    int i = x / period;
+    int t = x % period;
+    int a = int(random_below(random_bits(noise_seed, uint(i)), range));
+    int b = int(random_below(random_bits(noise_seed, uint(i + 1)), range));
+    return (a * (period - t) + b * t) / period - noise_amplitude;
+}
+
+// Must match WorldGenCell in WorldGen.hpp
+uint generate(ivec2 pos) {
+    uint cell_material = 0u;
+    if (kind == KIND_STRATA) {
+        for (int i = 0; i < num_layers; i++) {
+            if (pos.y >= layers[i].y && pos.y < layers[i].z) {
+                cell_material = uint(layers[i].x);
+            }
+        }
+    } else if (kind == KIND_TERRAIN) {
+        int height = base_height + value_noise(pos.x, feature_size, amplitude, seed) +
+                     value_noise(pos.x, max(feature_size / 4, 1), amplitude / 4, hash(seed));
+        if (pos.y < height) {
+            cell_material = material;
+        } else if (pos.y < fluid_level) {
+            cell_material = fluid;
+        }
+    } else if (kind == KIND_SCATTER) {
+        if ((random_bits(seed, pos) & 0xffu) < density) {
+            cell_material = material;
+        }
+    }
+    // color index 0, see CellData::Pack
+    return cell_material;
+}
+
+void main() {
+    ivec2 pos = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(pos, imageSize(img_prev)))) {
+        return;
+    }
+    uvec4 cell = uvec4(generate(pos), 0u, 0u, 0u);
+    imageStore(img_prev, pos, cell);
+    imageStore(img_curr, pos, cell);
+}
@@ -9,11 +9,14 @@
 #include "Input.hpp"
 #include "Path.hpp"
 #include "gl/Buffer.hpp"
+#include "gl/GpuProfiler.hpp"
 #include "gl/OpenGLDebug.hpp"
 #include "gl/ShaderManager.hpp"
 #include "gl/Texture.hpp"
 #include "gl/VertexArray.hpp"
 #include "pch.hpp"
+#include "sand_sim/Chunk.hpp"
+#include "sand_sim/Material.hpp"
 #include "sand_sim/SandSim.hpp"
 
 using gl::Buffer;
@@ -48,21 +51,16 @@ App::App()
 void App::Run() {
   glEnable(GL_DEBUG_OUTPUT);
   glDebugMessageCallback(gl::MessageCallback, nullptr);
-  ShaderManager::Init();
+  ShaderManager::Init(GET_PATH("shader_cache"));
+  shader_watcher_.Init(GET_SHADER_PATH(""));
+  gl::GpuProfiler::Init();
   ShaderManager::Get().AddShader(
-      "demo", {
-                  {GET_SHADER_PATH("demo.cs.glsl"),
-                   ShaderType::kCompute,
-                   {std::make_pair("WORK_GROUP_X", std::to_string(kWorkGroupX)),
-                    std::make_pair("WORK_GROUP_Y", std::to_string(kWorkGroupY))}},
-              });
-
-  ShaderManager::Get().AddShader("quad",
-                                 {{GET_SHADER_PATH("quad.vs.glsl"), ShaderType::kVertex, {}},
-                                  {GET_SHADER_PATH("quad.fs.glsl"), ShaderType::kFragment, {}}});
+      "quad", {{GET_SHADER_PATH("quad.vs.glsl"), ShaderType::kVertex, {}},
+               {GET_SHADER_PATH("quad.fs.glsl"), ShaderType::kFragment, MaterialDefines()}});
 
   constexpr size_t kBoardX{kDefaultScreenWidth};
-  constexpr size_t kBoardY{kDefaultScreenHeight};
+  // whole chunks, so the window onto the world scrolls a chunk at a time
+  constexpr size_t kBoardY{kDefaultScreenHeight / kChunkSize * kChunkSize};
   VertexArray quad_vao;
   Buffer quad_vbo;
   quad_vao.Init();
@@ -75,7 +73,20 @@ void App::Run() {
   double prev_time = curr_time;
   window_.SetVsync(true);
 
-  sand_sim_.Start({kBoardX, kBoardY}, {kWorkGroupX, kWorkGroupY});
+  // tuned on the first run on each device, see KernelTuner
+  SandSimCreateInfo sim_info{.dims = {kBoardX, kBoardY},
+                             .work_group_size = {},
+                             .sim_thread = true,
+                             .world_dir = GET_PATH("world")};
+  kernel_tuner_.emplace(GET_PATH("kernel_tuning.txt"));
+  std::optional<KernelConfig> kernel_config =
+      kernel_tuner_->Lookup(sim_info.rules, sim_info.cell_format);
+  if (!kernel_config.has_value()) {
+    kernel_config = kernel_tuner_->Tune(sim_info.dims, sim_info.rules, sim_info.cell_format);
+  }
+  sim_info.work_group_size = kernel_config->work_group_size;
+  sim_info.kernel = kernel_config->kernel;
+  sand_sim_.Start(sim_info);
 
   while (!window_.ShouldClose()) {
     curr_time = SDL_GetPerformanceCounter();
@@ -94,32 +105,31 @@ void App::Run() {
       sum = 0;
     }
     window_.PollEvents();
+    if (shader_watcher_.Poll()) ShaderManager::Get().RecompileShadersAsync();
+    ShaderManager::Get().PollPendingPrograms();
     sand_sim_.Update();
     window_.StartRenderFrame(imgui_enabled_);
 
-    static double s = 0;
-    s += dt;
-    bool tick = false;
-    if (s > 1.f / 120.f) {
-      s = 0;
-      tick = true;
-    }
-    if (tick) {
-      sand_sim_.Simulate();
+    sand_sim_.Simulate(tick_scheduler_.Advance(dt));
+
+    {
+      gl::GpuScope gpu_scope("quad");
+      Shader quad_shader = ShaderManager::Get().GetShader("quad").value();
+      quad_shader.Bind();
+      quad_vao.Bind();
+      glBindTextureUnit(0, sand_sim_.GetCurrTex().Id());
+      glClearColor(0, 0, 0, 1);
+      glClear(GL_COLOR_BUFFER_BIT);
+      glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
     }
 
-    Shader quad_shader = ShaderManager::Get().GetShader("quad").value();
-    quad_shader.Bind();
-    quad_vao.Bind();
-    glBindTextureUnit(0, sand_sim_.GetCurrTex().Id());
-    glClearColor(0, 0, 0, 1);
-    glClear(GL_COLOR_BUFFER_BIT);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-
     if (imgui_enabled_) OnImGui();
     window_.EndRenderFrame(imgui_enabled_);
+    gl::GpuProfiler::Get().Update();
   }
 
+  sand_sim_.SaveWorld();
+  gl::GpuProfiler::Shutdown();
   ShaderManager::Shutdown();
 }
 
@@ -130,9 +140,24 @@ void App::OnEvent(const SDL_Event& event) {
       return;
     }
     if (event.key.keysym.sym == SDLK_r && event.key.keysym.mod & KMOD_ALT) {
-      ShaderManager::Get().RecompileShaders();
+      ShaderManager::Get().RecompileShadersAsync();
       return;
     }
+    // key repeat keeps scrolling while an arrow key is held
+    switch (event.key.keysym.sym) {
+      case SDLK_LEFT:
+        sand_sim_.ScrollWorld({-1, 0});
+        return;
+      case SDLK_RIGHT:
+        sand_sim_.ScrollWorld({1, 0});
+        return;
+      case SDLK_DOWN:
+        sand_sim_.ScrollWorld({0, -1});
+        return;
+      case SDLK_UP:
+        sand_sim_.ScrollWorld({0, 1});
+        return;
+    }
   }
   switch (event.type) {
     case SDL_KEYDOWN:
@@ -153,8 +178,16 @@ void App::OnEvent(const SDL_Event& event) {
 }
 void App::OnImGui() {
   ImGui::Begin("Sand");
-  ImGui::Text("test");
+  tick_scheduler_.OnImGui();
+  // stalls for a second or two while every candidate is timed
+  if (sand_sim_.GetBackend() == SimBackend::kGpu && ImGui::Button("Retune kernels")) {
+    KernelConfig config = kernel_tuner_->Tune(sand_sim_.GetDims(), sand_sim_.GetRules(),
+                                              sand_sim_.GetCellFormat());
+    sand_sim_.SetWorkGroupSize(config.work_group_size);
+    sand_sim_.SetKernel(config.kernel);
+  }
   ImGui::End();
+  sand_sim_.OnImGui();
 }
 
 }  // namespace sand
@@ -1,4 +1,7 @@
+#include "FileWatcher.hpp"
+#include "TickScheduler.hpp"
 #include "Window.hpp"
+#include "sand_sim/KernelTuner.hpp"
 #include "sand_sim/SandSim.hpp"
 
 namespace sand {
@@ -13,8 +16,12 @@ class App {
   bool imgui_enabled_{true};
   void OnEvent(const SDL_Event& event);
   void OnImGui();
-  static constexpr const uint32_t kWorkGroupX = 10, kWorkGroupY = 10;
   SandSim sand_sim_;
+  // created once the ShaderManager exists
+  std::optional<KernelTuner> kernel_tuner_;
+  TickScheduler tick_scheduler_;
+  // recompiles shaders when a file in resources/shaders is saved
+  FileWatcher shader_watcher_;
 };
 
 }  // namespace sand
@@ -0,0 +1,459 @@
+#include "Bench.hpp"
+
+#include <spdlog/fmt/fmt.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+
+#include "Window.hpp"
+#include "gl/OpenGLDebug.hpp"
+#include "gl/ShaderManager.hpp"
+#include "sand_sim/BatchSim.hpp"
+#include "sand_sim/Cell.hpp"
+#include "sand_sim/Material.hpp"
+#include "sand_sim/SandSim.hpp"
+#include "sand_sim/Scenario.hpp"
+#include "sand_sim/Snapshot.hpp"
+
+namespace sand {
+
+namespace {
+
+constexpr const char* kUsage =
+    "usage: sand --bench <scenario> [--ticks N] [--batch N] [--backend cpu|gpu] [--size WxH]\n"
+    "                  [--threads N] [--work-group XxY] [--kernel basic|tiled]\n"
+    "                  [--cell-format r8|r32] [--load SNAPSHOT] [--save SNAPSHOT]\n"
+    "                  [--record LOG] [--replay LOG] [--cpu-kernel bitplane|scalar]\n"
+    "                  [--rules gather|margolus] [--check-conservation] [--worlds N]\n"
+    "                  [--generate terrain|scatter|fill]\n"
+    "       sand --bench --list\n"
+    "--worlds runs N copies of the scenario as one batch, each with its own random seed.\n"
+    "The gpu backend needs a GL 4.6 context. Without a display, run with\n"
+    "SDL_VIDEODRIVER=offscreen, and LIBGL_ALWAYS_SOFTWARE=1 for a software rasterizer.";
+
+struct BenchOptions {
+  std::string scenario;
+  uint32_t ticks{1000};
+  // ticks per Simulate call
+  uint32_t batch{1};
+  SimBackend backend{SimBackend::kCpu};
+  KernelVariant kernel{KernelVariant::kBasic};
+  CellFormat cell_format{CellFormat::kR8ui};
+  CpuKernel cpu_kernel{CpuKernel::kBitPlane};
+  SimRules rules{SimRules::kMargolus};
+  glm::ivec2 dims{1600, 900};
+  glm::ivec2 work_group_size{10, 10};
+  uint32_t num_threads{0};
+  // replaces the scenario's initial grid, the scenario still supplies the modifications
+  std::string load_path;
+  // same, with a board generated in place by SandSim::Generate
+  std::optional<WorldGenKind> generate;
+  // written after the last tick
+  std::string save_path;
+  // logs the applied modifications of every tick
+  std::string record_path;
+  // replaces the scenario's modifications with a recorded log
+  std::string replay_path;
+  // fails the run if a batch without modifications changes how many cells of a material exist
+  bool check_conservation{false};
+  // 0 runs one SandSim, otherwise a BatchSim of this many worlds
+  uint32_t worlds{0};
+  bool list{false};
+};
+
+bool ParseUint(std::string_view str, uint32_t& out) {
+  auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), out);
+  return ec == std::errc() && ptr == str.data() + str.size();
+}
+
+bool ParseDims(std::string_view str, glm::ivec2& out) {
+  size_t split = str.find('x');
+  if (split == std::string_view::npos) return false;
+  uint32_t x, y;
+  if (!ParseUint(str.substr(0, split), x) || !ParseUint(str.substr(split + 1), y)) return false;
+  if (x == 0 || y == 0) return false;
+  out = {x, y};
+  return true;
+}
+
+std::optional<BenchOptions> ParseArgs(int argc, char* argv[]) {
+  BenchOptions options;
+  for (int i = 1; i < argc; i++) {
+    std::string_view arg = argv[i];
+    std::string_view value = i + 1 < argc ? argv[i + 1] : "";
+    bool ok = true;
+    if (arg == "--bench") {
+      if (!value.empty() && !value.starts_with("--")) {
+        options.scenario = value;
+        i++;
+      }
+      continue;
+    }
+    if (arg == "--list") {
+      options.list = true;
+      continue;
+    }
+    if (arg == "--check-conservation") {
+      options.check_conservation = true;
+      continue;
+    }
+    if (arg == "--ticks") {
+      ok = ParseUint(value, options.ticks) && options.ticks > 0;
+    } else if (arg == "--batch") {
+      ok = ParseUint(value, options.batch) && options.batch > 0;
+    } else if (arg == "--threads") {
+      ok = ParseUint(value, options.num_threads);
+    } else if (arg == "--size") {
+      ok = ParseDims(value, options.dims);
+    } else if (arg == "--work-group") {
+      ok = ParseDims(value, options.work_group_size);
+    } else if (arg == "--kernel") {
+      ok = value == "basic" || value == "tiled";
+      options.kernel = value == "tiled" ? KernelVariant::kTiled : KernelVariant::kBasic;
+    } else if (arg == "--cell-format") {
+      ok = value == "r8" || value == "r32";
+      options.cell_format = value == "r32" ? CellFormat::kR32ui : CellFormat::kR8ui;
+    } else if (arg == "--cpu-kernel") {
+      ok = value == "bitplane" || value == "scalar";
+      options.cpu_kernel = value == "scalar" ? CpuKernel::kScalar : CpuKernel::kBitPlane;
+    } else if (arg == "--rules") {
+      ok = value == "gather" || value == "margolus";
+      options.rules = value == "gather" ? SimRules::kGather : SimRules::kMargolus;
+    } else if (arg == "--load") {
+      ok = !value.empty();
+      options.load_path = value;
+    } else if (arg == "--save") {
+      ok = !value.empty();
+      options.save_path = value;
+    } else if (arg == "--record") {
+      ok = !value.empty();
+      options.record_path = value;
+    } else if (arg == "--replay") {
+      ok = !value.empty();
+      options.replay_path = value;
+    } else if (arg == "--generate") {
+      ok = value == "terrain" || value == "scatter" || value == "fill";
+      options.generate = value == "terrain"   ? WorldGenKind::kTerrain
+                         : value == "scatter" ? WorldGenKind::kScatter
+                                              : WorldGenKind::kFill;
+    } else if (arg == "--worlds") {
+      ok = ParseUint(value, options.worlds) && options.worlds > 0;
+    } else if (arg == "--backend") {
+      ok = value == "cpu" || value == "gpu";
+      options.backend = value == "gpu" ? SimBackend::kGpu : SimBackend::kCpu;
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      spdlog::error("Invalid argument: {} {}", arg, value);
+      return std::nullopt;
+    }
+    i++;
+  }
+  if (options.check_conservation && !options.replay_path.empty()) {
+    spdlog::error("--check-conservation needs the scenario's modifications, not a replay");
+    return std::nullopt;
+  }
+  if (options.generate.has_value() && !options.load_path.empty()) {
+    spdlog::error("--generate and --load both replace the initial grid");
+    return std::nullopt;
+  }
+  if (options.worlds > 0 &&
+      (!options.load_path.empty() || options.generate.has_value() || !options.save_path.empty() ||
+       !options.record_path.empty() || !options.replay_path.empty() ||
+       options.check_conservation || options.kernel == KernelVariant::kTiled)) {
+    spdlog::error("--worlds only runs scenarios with the basic kernel");
+    return std::nullopt;
+  }
+  if (!options.list && options.scenario.empty()) {
+    spdlog::error("No scenario given");
+    return std::nullopt;
+  }
+  return options;
+}
+
+// FNV-1a, so two runs can be checked for identical final grids. Pass the hash of the previous
+// grid to hash several as one.
+uint64_t HashGrid(const std::vector<uint32_t>& grid, uint64_t hash = 14695981039346656037ull) {
+  for (uint32_t cell : grid) {
+    hash = (hash ^ cell) * 1099511628211ull;
+  }
+  return hash;
+}
+
+using MaterialCounts = std::array<uint64_t, kMaterialSlots>;
+
+MaterialCounts CountMaterials(const std::vector<uint32_t>& grid) {
+  MaterialCounts counts{};
+  for (uint32_t cell : grid) counts[cell & 0xf]++;
+  return counts;
+}
+
+double Percentile(std::vector<double> values, double percentile) {
+  auto index = static_cast<size_t>(percentile * static_cast<double>(values.size() - 1));
+  std::nth_element(values.begin(), values.begin() + index, values.end());
+  return values[index];
+}
+
+double MsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+// A board of the given kind scaled to dims.
+WorldGenDesc GeneratedBoard(WorldGenKind kind, const glm::ivec2& dims) {
+  switch (kind) {
+    case WorldGenKind::kTerrain:
+      return {.kind = kind,
+              .material = MaterialType::kSand,
+              .seed = 1,
+              .base_height = dims.y / 3,
+              .amplitude = dims.y / 6,
+              .feature_size = std::max(dims.x / 8, 1),
+              .fluid = MaterialType::kWater,
+              .fluid_level = dims.y / 3};
+    case WorldGenKind::kScatter:
+      // a quarter of the cells, like the noise scenario
+      return {.kind = kind, .material = MaterialType::kSand, .seed = 1, .density = 64};
+    default:
+      return {.kind = WorldGenKind::kFill, .material = MaterialType::kSand};
+  }
+}
+
+bool RunTicks(const BenchOptions& options, const Scenario& scenario) {
+  SandSim sim;
+  sim.Start({.dims = options.dims,
+             .work_group_size = options.work_group_size,
+             .backend = options.backend,
+             .rules = options.rules,
+             .kernel = options.kernel,
+             .cell_format = options.cell_format,
+             .cpu_kernel = options.cpu_kernel,
+             .num_threads = options.num_threads,
+             .headless = true});
+  double load_ms = 0;
+  if (options.generate.has_value()) {
+    auto start = std::chrono::steady_clock::now();
+    sim.Generate(GeneratedBoard(*options.generate, options.dims));
+    if (options.backend == SimBackend::kGpu) glFinish();
+    load_ms = MsSince(start);
+  } else if (options.load_path.empty()) {
+    std::vector<uint32_t> grid(static_cast<size_t>(options.dims.x) * options.dims.y, 0);
+    scenario.init(grid, options.dims);
+    sim.SetGrid(grid);
+  } else {
+    auto start = std::chrono::steady_clock::now();
+    if (!sim.LoadSnapshot(options.load_path)) return false;
+    if (options.backend == SimBackend::kGpu) glFinish();
+    load_ms = MsSince(start);
+  }
+
+  if (!options.record_path.empty() && !sim.StartRecording(options.record_path)) return false;
+  if (!options.replay_path.empty() && !sim.StartReplay(options.replay_path)) return false;
+
+  // per tick, averaged over each batch
+  std::vector<double> tick_ms;
+  tick_ms.reserve(options.ticks);
+  double total_ms = 0;
+  std::vector<Modification> modifications;
+  MaterialCounts counts{};
+  if (options.check_conservation) counts = CountMaterials(sim.GetGrid());
+  for (uint32_t tick = 0; tick < options.ticks; tick += options.batch) {
+    uint32_t batch = std::min(options.batch, options.ticks - tick);
+    bool modified = false;
+    // scenario modifications of a whole batch land on its first tick, a replay keeps its own ticks
+    for (uint32_t i = tick; options.replay_path.empty() && i < tick + batch; i++) {
+      modifications.clear();
+      scenario.modifications(i, options.dims, modifications);
+      for (const Modification& modification : modifications) {
+        sim.AddModification(modification);
+      }
+      modified |= !modifications.empty();
+    }
+    auto start = std::chrono::steady_clock::now();
+    sim.Simulate(batch);
+    // GL calls only queue work, so wait for it to get the real tick latency
+    if (options.backend == SimBackend::kGpu) glFinish();
+    double batch_ms = MsSince(start);
+    total_ms += batch_ms;
+    tick_ms.emplace_back(batch_ms / batch);
+    if (options.check_conservation) {
+      MaterialCounts new_counts = CountMaterials(sim.GetGrid());
+      for (uint32_t material = 0; !modified && material < kMaterialSlots; material++) {
+        if (new_counts[material] != counts[material]) {
+          spdlog::error("Material {} went from {} to {} cells over ticks {}-{}", material,
+                        counts[material], new_counts[material], tick, tick + batch - 1);
+          return false;
+        }
+      }
+      counts = new_counts;
+    }
+  }
+  sim.StopRecording();
+  double save_ms = 0;
+  if (!options.save_path.empty()) {
+    auto start = std::chrono::steady_clock::now();
+    if (!sim.SaveSnapshot(options.save_path)) return false;
+    save_ms = MsSince(start);
+  }
+
+  double cells = static_cast<double>(options.dims.x) * options.dims.y;
+  fmt::print("{{\n");
+  fmt::print("  \"scenario\": \"{}\",\n", scenario.name);
+  fmt::print("  \"backend\": \"{}\",\n", options.backend == SimBackend::kGpu ? "gpu" : "cpu");
+  fmt::print("  \"kernel\": \"{}\",\n",
+             options.kernel == KernelVariant::kTiled ? "tiled" : "basic");
+  fmt::print("  \"cpu_kernel\": \"{}\",\n",
+             options.cpu_kernel == CpuKernel::kScalar ? "scalar" : "bitplane");
+  fmt::print("  \"rules\": \"{}\",\n",
+             options.rules == SimRules::kGather ? "gather" : "margolus");
+  fmt::print("  \"cell_format\": \"{}\",\n",
+             options.cell_format == CellFormat::kR32ui ? "r32" : "r8");
+  fmt::print("  \"width\": {},\n", options.dims.x);
+  fmt::print("  \"height\": {},\n", options.dims.y);
+  fmt::print("  \"ticks\": {},\n", options.ticks);
+  fmt::print("  \"batch\": {},\n", options.batch);
+  fmt::print("  \"threads\": {},\n",
+             options.backend == SimBackend::kGpu ? 0 : options.num_threads);
+  fmt::print("  \"total_ms\": {:.3f},\n", total_ms);
+  fmt::print("  \"ticks_per_sec\": {:.3f},\n", options.ticks / (total_ms / 1000.0));
+  fmt::print("  \"ns_per_cell\": {:.4f},\n", total_ms * 1e6 / (cells * options.ticks));
+  fmt::print("  \"p50_ms\": {:.4f},\n", Percentile(tick_ms, 0.5));
+  fmt::print("  \"p99_ms\": {:.4f},\n", Percentile(tick_ms, 0.99));
+  if (!options.load_path.empty()) fmt::print("  \"load_ms\": {:.3f},\n", load_ms);
+  if (options.generate.has_value()) fmt::print("  \"generate_ms\": {:.3f},\n", load_ms);
+  if (!options.save_path.empty()) fmt::print("  \"save_ms\": {:.3f},\n", save_ms);
+  fmt::print("  \"grid_hash\": \"{:016x}\"\n", HashGrid(sim.GetGrid()));
+  fmt::print("}}\n");
+  return true;
+}
+
+bool RunWorlds(const BenchOptions& options, const Scenario& scenario) {
+  BatchSim sim;
+  auto num_worlds = static_cast<int>(options.worlds);
+  sim.Start({.dims = options.dims,
+             .num_worlds = num_worlds,
+             .work_group_size = options.work_group_size,
+             .backend = options.backend,
+             .rules = options.rules,
+             .cell_format = options.cell_format,
+             .cpu_kernel = options.cpu_kernel,
+             .num_threads = options.num_threads});
+  std::vector<uint32_t> grid(static_cast<size_t>(options.dims.x) * options.dims.y, 0);
+  scenario.init(grid, options.dims);
+  for (int world = 0; world < num_worlds; world++) {
+    sim.SetGrid(world, grid);
+    sim.SetRuleParams(world, {.seed = static_cast<uint32_t>(world)});
+  }
+
+  std::vector<double> tick_ms;
+  tick_ms.reserve(options.ticks);
+  double total_ms = 0;
+  std::vector<Modification> modifications;
+  for (uint32_t tick = 0; tick < options.ticks; tick += options.batch) {
+    uint32_t batch = std::min(options.batch, options.ticks - tick);
+    for (uint32_t i = tick; i < tick + batch; i++) {
+      modifications.clear();
+      scenario.modifications(i, options.dims, modifications);
+      for (int world = 0; world < num_worlds; world++) {
+        for (Modification modification : modifications) {
+          modification.world = world;
+          sim.AddModification(modification);
+        }
+      }
+    }
+    auto start = std::chrono::steady_clock::now();
+    sim.Simulate(batch);
+    if (options.backend == SimBackend::kGpu) glFinish();
+    double batch_ms = MsSince(start);
+    total_ms += batch_ms;
+    tick_ms.emplace_back(batch_ms / batch);
+  }
+
+  uint64_t hash = 14695981039346656037ull;
+  for (int world = 0; world < num_worlds; world++) hash = HashGrid(sim.GetGrid(world), hash);
+  double cells = static_cast<double>(options.dims.x) * options.dims.y * num_worlds;
+  fmt::print("{{\n");
+  fmt::print("  \"scenario\": \"{}\",\n", scenario.name);
+  fmt::print("  \"backend\": \"{}\",\n", options.backend == SimBackend::kGpu ? "gpu" : "cpu");
+  fmt::print("  \"cpu_kernel\": \"{}\",\n",
+             options.cpu_kernel == CpuKernel::kScalar ? "scalar" : "bitplane");
+  fmt::print("  \"rules\": \"{}\",\n",
+             options.rules == SimRules::kGather ? "gather" : "margolus");
+  fmt::print("  \"cell_format\": \"{}\",\n",
+             options.cell_format == CellFormat::kR32ui ? "r32" : "r8");
+  fmt::print("  \"width\": {},\n", options.dims.x);
+  fmt::print("  \"height\": {},\n", options.dims.y);
+  fmt::print("  \"worlds\": {},\n", num_worlds);
+  fmt::print("  \"ticks\": {},\n", options.ticks);
+  fmt::print("  \"batch\": {},\n", options.batch);
+  fmt::print("  \"threads\": {},\n",
+             options.backend == SimBackend::kGpu ? 0 : options.num_threads);
+  fmt::print("  \"total_ms\": {:.3f},\n", total_ms);
+  fmt::print("  \"ticks_per_sec\": {:.3f},\n", options.ticks / (total_ms / 1000.0));
+  fmt::print("  \"world_ticks_per_sec\": {:.3f},\n",
+             static_cast<double>(options.ticks) * num_worlds / (total_ms / 1000.0));
+  fmt::print("  \"ns_per_cell\": {:.4f},\n", total_ms * 1e6 / (cells * options.ticks));
+  fmt::print("  \"p50_ms\": {:.4f},\n", Percentile(tick_ms, 0.5));
+  fmt::print("  \"p99_ms\": {:.4f},\n", Percentile(tick_ms, 0.99));
+  fmt::print("  \"grid_hash\": \"{:016x}\"\n", hash);
+  fmt::print("}}\n");
+  return true;
+}
+
+bool Run(const BenchOptions& options, const Scenario& scenario) {
+  return options.worlds > 0 ? RunWorlds(options, scenario) : RunTicks(options, scenario);
+}
+
+}  // namespace
+
+bool IsBenchCommand(int argc, char* argv[]) {
+  for (int i = 1; i < argc; i++) {
+    if (std::string_view(argv[i]) == "--bench") return true;
+  }
+  return false;
+}
+
+int RunBench(int argc, char* argv[]) {
+  // keep stdout clean for the JSON report
+  spdlog::set_default_logger(spdlog::stderr_color_mt("bench"));
+  std::optional<BenchOptions> options = ParseArgs(argc, argv);
+  if (!options.has_value()) {
+    std::fprintf(stderr, "%s\n", kUsage);
+    return 1;
+  }
+  if (options->list) {
+    for (const Scenario& scenario : GetScenarios()) {
+      fmt::print("{:<10} {}\n", scenario.name, scenario.description);
+    }
+    return 0;
+  }
+  const Scenario* scenario = FindScenario(options->scenario);
+  if (!scenario) {
+    spdlog::error("Unknown scenario: {}", options->scenario);
+    return 1;
+  }
+  if (!options->load_path.empty()) {
+    std::optional<MappedSnapshot> snapshot = MappedSnapshot::Open(options->load_path);
+    if (!snapshot.has_value()) return 1;
+    options->dims = snapshot->Dims();
+  }
+  if (options->num_threads == 0) options->num_threads = std::thread::hardware_concurrency();
+
+  if (options->backend == SimBackend::kCpu) {
+    return Run(*options, *scenario) ? 0 : 1;
+  }
+  Window window(options->dims.x, options->dims.y, "Sand Bench", [](SDL_Event&) {}, true);
+  window.SetVsync(false);
+  glEnable(GL_DEBUG_OUTPUT);
+  glDebugMessageCallback(gl::MessageCallback, nullptr);
+  gl::ShaderManager::Init();
+  bool ok = Run(*options, *scenario);
+  gl::ShaderManager::Shutdown();
+  window.Shutdown();
+  return ok ? 0 : 1;
+}
+
+}  // namespace sand
@@ -0,0 +1,11 @@
+#pragma once
+
+namespace sand {
+
+// True when the command line asks for the headless benchmark instead of the app.
+bool IsBenchCommand(int argc, char* argv[]);
+// Runs a scenario for a fixed number of ticks without rendering and prints the timings as JSON
+// to stdout. Returns the process exit code.
+int RunBench(int argc, char* argv[]);
+
+}  // namespace sand
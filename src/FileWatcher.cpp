@@ -0,0 +1,57 @@
+#include "FileWatcher.hpp"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#endif
+
+namespace sand {
+
+#ifdef __linux__
+
+FileWatcher::~FileWatcher() {
+  if (fd_ != -1) close(fd_);
+}
+
+bool FileWatcher::Init(const std::filesystem::path& dir) {
+  if (fd_ != -1) close(fd_);
+  fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd_ == -1) {
+    spdlog::error("Failed to create inotify instance: {}", std::strerror(errno));
+    return false;
+  }
+  if (inotify_add_watch(fd_, dir.c_str(), IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO) == -1) {
+    spdlog::error("Failed to watch {}: {}", dir.string(), std::strerror(errno));
+    close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  return true;
+}
+
+bool FileWatcher::Poll() {
+  if (fd_ == -1) return false;
+  // only whether anything happened matters, so the events themselves are skipped
+  alignas(inotify_event) char buffer[4096];
+  bool changed = false;
+  while (read(fd_, buffer, sizeof(buffer)) > 0) changed = true;
+  return changed;
+}
+
+#else
+
+FileWatcher::~FileWatcher() = default;
+
+bool FileWatcher::Init(const std::filesystem::path& dir) {
+  spdlog::warn("File watching is only supported on Linux, not watching {}", dir.string());
+  return false;
+}
+
+bool FileWatcher::Poll() { return false; }
+
+#endif
+
+}  // namespace sand
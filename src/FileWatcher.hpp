@@ -0,0 +1,27 @@
+#pragma once
+
+#include <filesystem>
+
+namespace sand {
+
+// Watches a directory for written, created or moved in files without blocking. Uses inotify on
+// Linux and never reports changes elsewhere.
+class FileWatcher {
+ public:
+  FileWatcher() = default;
+  FileWatcher(const FileWatcher& other) = delete;
+  FileWatcher& operator=(const FileWatcher& other) = delete;
+  ~FileWatcher();
+
+  // Returns false if the directory can't be watched.
+  bool Init(const std::filesystem::path& dir);
+  // Drains the pending events and returns true if any file in the directory changed since the
+  // last call. Editors that save through a temporary file fire several events, which are
+  // reported as one change when they arrive before the same call.
+  bool Poll();
+
+ private:
+  int fd_{-1};
+};
+
+}  // namespace sand
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+
+namespace sand {
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread. Holds up to
+// Capacity - 1 items, one slot stays free to tell a full queue from an empty one.
+template <typename T, size_t Capacity>
+class SpscQueue {
+  static_assert(Capacity >= 2, "SpscQueue needs at least two slots");
+
+ public:
+  // Producer only. Returns false and leaves value untouched if the queue is full.
+  template <typename U>
+  bool TryPush(U&& value) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t next = (tail + 1) % Capacity;
+    if (next == head_.load(std::memory_order_acquire)) return false;
+    slots_[tail] = std::forward<U>(value);
+    tail_.store(next, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only. Returns nullopt if the queue is empty.
+  std::optional<T> TryPop() {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) return std::nullopt;
+    std::optional<T> value = std::move(slots_[head]);
+    head_.store((head + 1) % Capacity, std::memory_order_release);
+    return value;
+  }
+
+ private:
+  std::array<T, Capacity> slots_{};
+  // next slot to pop, written by the consumer
+  alignas(64) std::atomic<size_t> head_{0};
+  // next slot to push, written by the producer
+  alignas(64) std::atomic<size_t> tail_{0};
+};
+
+}  // namespace sand
@@ -0,0 +1,72 @@
+#include "ThreadPool.hpp"
+
+namespace sand {
+
+ThreadPool::ThreadPool(uint32_t num_threads) {
+  num_threads = std::max(num_threads, 1u);
+  workers_.reserve(num_threads - 1);
+  for (uint32_t i = 0; i < num_threads - 1; i++) {
+    workers_.emplace_back([this]() { WorkerLoop(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  work_cv_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+void ThreadPool::ParallelFor(uint32_t count, const std::function<void(uint32_t)>& func) {
+  if (count == 0) return;
+  if (workers_.empty() || count == 1) {
+    for (uint32_t i = 0; i < count; i++) func(i);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    func_ = &func;
+    count_ = count;
+    next_index_.store(0, std::memory_order_relaxed);
+    active_workers_ = static_cast<uint32_t>(workers_.size());
+    generation_++;
+  }
+  work_cv_.notify_all();
+  RunJobs();
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cv_.wait(lock, [this]() { return active_workers_ == 0; });
+  func_ = nullptr;
+}
+
+void ThreadPool::RunJobs() {
+  for (uint32_t i = next_index_.fetch_add(1, std::memory_order_relaxed); i < count_;
+       i = next_index_.fetch_add(1, std::memory_order_relaxed)) {
+    (*func_)(i);
+  }
+}
+
+void ThreadPool::WorkerLoop() {
+  uint32_t seen_generation = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      work_cv_.wait(lock, [this, seen_generation]() {
+        return stop_ || generation_ != seen_generation;
+      });
+      if (stop_) return;
+      seen_generation = generation_;
+    }
+    RunJobs();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      active_workers_--;
+    }
+    done_cv_.notify_one();
+  }
+}
+
+}  // namespace sand
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace sand {
+
+// Fixed set of worker threads used for data parallel loops. The calling thread takes part in
+// every loop, so a pool of N threads spawns N - 1 workers.
+class ThreadPool {
+ public:
+  explicit ThreadPool(uint32_t num_threads = std::thread::hardware_concurrency());
+  ThreadPool(const ThreadPool& other) = delete;
+  ThreadPool& operator=(const ThreadPool& other) = delete;
+  ~ThreadPool();
+
+  // Calls func(i) for every i in [0, count) and blocks until all calls have returned.
+  void ParallelFor(uint32_t count, const std::function<void(uint32_t)>& func);
+  [[nodiscard]] uint32_t NumThreads() const { return static_cast<uint32_t>(workers_.size()) + 1; }
+
+ private:
+  void WorkerLoop();
+  void RunJobs();
+
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  const std::function<void(uint32_t)>* func_{nullptr};
+  uint32_t count_{0};
+  std::atomic<uint32_t> next_index_{0};
+  uint32_t generation_{0};
+  uint32_t active_workers_{0};
+  bool stop_{false};
+};
+
+}  // namespace sand
@@ -0,0 +1,80 @@
+#include "TickScheduler.hpp"
+
+#include <imgui.h>
+
+#include <cmath>
+
+namespace sand {
+
+namespace {
+
+// seconds of history behind AchievedRate
+constexpr double kRateWindow = 1.0;
+
+}  // namespace
+
+TickScheduler::TickScheduler(double tick_rate) : tick_rate_(tick_rate) {}
+
+uint32_t TickScheduler::Advance(double dt) {
+  time_ += dt;
+  uint32_t ticks = 0;
+  if (!paused) {
+    accumulator_ += dt;
+    double tick_time = 1.0 / tick_rate_;
+    // a budget under one tick would never let a tick through
+    double budget = std::max(max_catch_up, tick_time);
+    if (accumulator_ > budget) {
+      dropped_time_ += accumulator_ - budget;
+      accumulator_ = budget;
+    }
+    ticks = std::min(static_cast<uint32_t>(std::floor(accumulator_ / tick_time)),
+                     max_ticks_per_frame);
+    accumulator_ -= ticks * tick_time;
+  }
+  history_.push_back({time_, ticks});
+  while (history_.front().time < time_ - kRateWindow) history_.pop_front();
+  return ticks;
+}
+
+void TickScheduler::SetTickRate(double tick_rate) {
+  EASSERT_MSG(tick_rate > 0, "Tick rate must be positive");
+  tick_rate_ = tick_rate;
+  accumulator_ = 0;
+}
+
+double TickScheduler::AchievedRate() const {
+  double window = std::min(time_, kRateWindow);
+  if (window <= 0) return 0;
+  uint32_t ticks = 0;
+  for (const FrameTicks& frame : history_) ticks += frame.ticks;
+  return ticks / window;
+}
+
+double TickScheduler::Deficit() const {
+  if (paused) return 0;
+  return std::max(tick_rate_ - AchievedRate(), 0.0);
+}
+
+void TickScheduler::OnImGui() {
+  float tick_rate = static_cast<float>(tick_rate_);
+  if (ImGui::SliderFloat("Tick rate", &tick_rate, 1.f, 1000.f, "%.0f Hz")) {
+    SetTickRate(tick_rate);
+  }
+  int max_ticks = static_cast<int>(max_ticks_per_frame);
+  if (ImGui::SliderInt("Max ticks per frame", &max_ticks, 1, 64)) {
+    max_ticks_per_frame = static_cast<uint32_t>(max_ticks);
+  }
+  float catch_up = static_cast<float>(max_catch_up);
+  if (ImGui::SliderFloat("Catch-up budget", &catch_up, 0.01f, 1.f, "%.2f s")) {
+    max_catch_up = catch_up;
+  }
+  ImGui::Checkbox("Paused", &paused);
+  ImGui::Text("Achieved: %.1f ticks/s", AchievedRate());
+  // a couple of ticks of jitter between frames is expected
+  if (Deficit() > tick_rate_ * 0.02) {
+    ImGui::TextColored(ImVec4(1, 0.4f, 0.4f, 1), "Falling behind by %.1f ticks/s", Deficit());
+  }
+  ImGui::Text("Dropped: %.2f s", dropped_time_);
+}
+
+}  // namespace sand
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <deque>
+
+namespace sand {
+
+// Fixed timestep scheduler. Real time accumulates each frame and is spent in whole ticks, so the
+// sim runs at the same speed regardless of frame rate. When ticks can't keep up, the accumulator
+// is capped at the catch-up budget and the rest of the time is dropped instead of spiraling.
+class TickScheduler {
+ public:
+  explicit TickScheduler(double tick_rate = 120.0);
+
+  // Adds dt seconds of real time and returns the number of ticks to run this frame.
+  uint32_t Advance(double dt);
+
+  void SetTickRate(double tick_rate);
+  [[nodiscard]] double TickRate() const { return tick_rate_; }
+  // Ticks per second actually run over the last second.
+  [[nodiscard]] double AchievedRate() const;
+  // How far the achieved rate falls short of the tick rate, 0 when keeping up.
+  [[nodiscard]] double Deficit() const;
+  // Time that was dropped because it exceeded the catch-up budget, in seconds.
+  [[nodiscard]] double DroppedTime() const { return dropped_time_; }
+  void OnImGui();
+
+  // Most time the accumulator holds on to, in seconds. Never less than one tick.
+  double max_catch_up{0.25};
+  // Most ticks run in one frame. Extra ticks stay in the accumulator for the next frames.
+  uint32_t max_ticks_per_frame{8};
+  bool paused{false};
+
+ private:
+  struct FrameTicks {
+    double time;
+    uint32_t ticks;
+  };
+  double tick_rate_;
+  double accumulator_{0};
+  double dropped_time_{0};
+  double time_{0};
+  // ticks per frame over the last second, for the achieved rate
+  std::deque<FrameTicks> history_;
+};
+
+}  // namespace sand
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+
+namespace sand {
+
+// Lock-free handoff of the latest value from one producer thread to one consumer thread. Each
+// side owns one of three buffers and the third is swapped through an atomic, so the producer
+// never waits and the consumer always gets the newest published value, skipping older ones.
+template <typename T>
+class TripleBuffer {
+ public:
+  // Producer only. The buffer to fill before the next Publish.
+  T& WriteBuffer() { return buffers_[write_]; }
+  // Producer only. Hands the write buffer over and takes the spare one.
+  void Publish() {
+    uint8_t spare = shared_.exchange(write_ | kFresh, std::memory_order_acq_rel);
+    write_ = spare & kIndexMask;
+  }
+
+  // Consumer only. Switches ReadBuffer to the newest published value, or returns false if
+  // nothing was published since the last call.
+  bool Consume() {
+    if (!(shared_.load(std::memory_order_relaxed) & kFresh)) return false;
+    uint8_t fresh = shared_.exchange(read_, std::memory_order_acq_rel);
+    read_ = fresh & kIndexMask;
+    return true;
+  }
+  // Consumer only.
+  [[nodiscard]] const T& ReadBuffer() const { return buffers_[read_]; }
+
+ private:
+  static constexpr uint8_t kIndexMask = 0x3;
+  // set while the shared buffer holds a value the consumer hasn't seen
+  static constexpr uint8_t kFresh = 0x4;
+
+  std::array<T, 3> buffers_{};
+  uint8_t write_{0};
+  uint8_t read_{1};
+  // index of the spare buffer and kFresh
+  std::atomic<uint8_t> shared_{2};
+};
+
+}  // namespace sand
@@ -7,6 +7,7 @@
 #include <imgui_impl_opengl3.h>
 #include <imgui_impl_sdl2.h>
 
+#include "gl/GpuProfiler.hpp"
 #include "pch.hpp"
 
 #if defined(IMGUI_IMPL_OPENGL_ES2)
@@ -94,7 +95,8 @@ void SetImGuiStyle() {
 
 namespace sand {
 
-Window::Window(int width, int height, const char* title, const EventCallback& event_callback) {
+Window::Window(int width, int height, const char* title, const EventCallback& event_callback,
+               bool hidden) {
   event_callback_ = event_callback;
   if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER | SDL_INIT_GAMECONTROLLER) != 0) {
     spdlog::critical("Error: {}\n", SDL_GetError());
@@ -143,8 +145,9 @@ Window::Window(int width, int height, const char* title, const EventCallback& ev
   SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
   SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
   SDL_GL_SetAttribute(SDL_GL_STENCIL_SIZE, 8);
-  auto window_flags = static_cast<SDL_WindowFlags>(SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE |
-                                                   SDL_WINDOW_ALLOW_HIGHDPI);
+  auto window_flags = static_cast<SDL_WindowFlags>(
+      SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI |
+      (hidden ? SDL_WINDOW_HIDDEN : 0));
   window_ = SDL_CreateWindow(title, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, width, height,
                              window_flags);
   gl_context = SDL_GL_CreateContext(window_);
@@ -233,6 +236,7 @@ void Window::StartRenderFrame(bool imgui_enabled) {
 void Window::EndRenderFrame(bool imgui_enabled) const {
   if (imgui_enabled) {
     ImGui::Render();
+    gl::GpuScope gpu_scope("imgui");
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
   }
   SDL_GL_SwapWindow(window_);
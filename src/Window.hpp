@@ -10,7 +10,9 @@ namespace sand {
 
 class Window {
  public:
-  Window(int width, int height, const char* title, const EventCallback& event_callback);
+  // A hidden window still owns a GL context, which is enough for offscreen work.
+  Window(int width, int height, const char* title, const EventCallback& event_callback,
+         bool hidden = false);
   void SetVsync(bool vsync);
   void Shutdown();
   void SetCursorVisible(bool cursor_visible);
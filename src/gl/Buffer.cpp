@@ -29,9 +29,13 @@ void Buffer::Bind(GLuint target) const { glBindBuffer(target, id_); }
 
 void Buffer::BindBase(GLuint target, GLuint slot) const { glBindBufferBase(target, slot, id_); }
 
+void Buffer::BindRange(GLuint target, GLuint slot, uint32_t offset, uint32_t size_bytes) const {
+  glBindBufferRange(target, slot, id_, offset, size_bytes);
+}
+
 void Buffer::SubDataStart(size_t size_bytes, void* data) {
   glNamedBufferSubData(id_, 0, size_bytes, data);
-  offset_ += size_bytes;
+  offset_ = size_bytes;
 }
 
 void Buffer::SubData(size_t size_bytes, void* data) {
@@ -17,6 +17,7 @@ class Buffer {
   void SubDataStart(size_t size_bytes, void* data);
   void Bind(uint32_t target) const;
   void BindBase(uint32_t target, uint32_t slot) const;
+  void BindRange(uint32_t target, uint32_t slot, uint32_t offset, uint32_t size_bytes) const;
   void ResetOffset();
   void SetOffset(uint32_t offset);
   void* Map(uint32_t access);
@@ -0,0 +1,102 @@
+#include "GpuProfiler.hpp"
+
+namespace gl {
+
+GpuProfiler* GpuProfiler::instance_ = nullptr;
+
+GpuProfiler& GpuProfiler::Get() { return *instance_; }
+
+void GpuProfiler::Init() {
+  EASSERT_MSG(instance_ == nullptr, "Can't make two instances");
+  instance_ = new GpuProfiler;
+}
+
+void GpuProfiler::Shutdown() {
+  EASSERT_MSG(instance_ != nullptr, "Can't shutdown before initializing");
+  delete instance_;
+  instance_ = nullptr;
+}
+
+GpuProfiler::GpuProfiler() = default;
+
+GpuProfiler::~GpuProfiler() {
+  for (auto& scope : scopes_) {
+    glDeleteQueries(scope.queries.size(), scope.queries.data());
+  }
+}
+
+GpuProfiler::Scope& GpuProfiler::FindOrAddScope(std::string_view name) {
+  // only a handful of scopes, a linear search avoids building a string per lookup
+  for (auto& scope : scopes_) {
+    if (scope.name == name) return scope;
+  }
+  Scope& scope = scopes_.emplace_back();
+  scope.name = name;
+  glCreateQueries(GL_TIMESTAMP, scope.queries.size(), scope.queries.data());
+  return scope;
+}
+
+void GpuProfiler::Begin(std::string_view name) {
+  Scope& scope = FindOrAddScope(name);
+  EASSERT_MSG(!scope.recording, "GPU scope already started");
+  if (scope.pending[scope.write_index]) {
+    Collect(scope);
+    // the GPU is more than a ring behind, drop this sample rather than wait
+    if (scope.pending[scope.write_index]) return;
+  }
+  glQueryCounter(scope.queries[scope.write_index * 2], GL_TIMESTAMP);
+  scope.recording = true;
+}
+
+void GpuProfiler::End(std::string_view name) {
+  Scope& scope = FindOrAddScope(name);
+  if (!scope.recording) return;
+  glQueryCounter(scope.queries[scope.write_index * 2 + 1], GL_TIMESTAMP);
+  scope.pending[scope.write_index] = true;
+  scope.frames[scope.write_index] = frame_;
+  scope.write_index = (scope.write_index + 1) % kQueryRingSize;
+  scope.recording = false;
+}
+
+void GpuProfiler::Collect(Scope& scope) {
+  // oldest slot first so the history stays in issue order
+  for (uint32_t i = 0; i < kQueryRingSize; i++) {
+    uint32_t slot = (scope.write_index + i) % kQueryRingSize;
+    if (!scope.pending[slot]) continue;
+    GLint available = 0;
+    glGetQueryObjectiv(scope.queries[slot * 2 + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) return;
+    GLuint64 start, end;
+    glGetQueryObjectui64v(scope.queries[slot * 2], GL_QUERY_RESULT, &start);
+    glGetQueryObjectui64v(scope.queries[slot * 2 + 1], GL_QUERY_RESULT, &end);
+    scope.pending[slot] = false;
+
+    float ms = static_cast<float>(end - start) / 1e6f;
+    scope.average_ms += (ms - scope.history_ms[scope.history_offset]) / kHistorySize;
+    scope.history_ms[scope.history_offset] = ms;
+    scope.history_offset = (scope.history_offset + 1) % kHistorySize;
+    if (csv_.is_open()) {
+      csv_ << scope.frames[slot] << ',' << scope.name << ',' << ms << '\n';
+    }
+  }
+}
+
+void GpuProfiler::Update() {
+  for (auto& scope : scopes_) {
+    Collect(scope);
+  }
+  frame_++;
+}
+
+void GpuProfiler::StartCsv(const std::string& path) {
+  csv_.open(path, std::ios::trunc);
+  if (!csv_.is_open()) {
+    spdlog::error("Failed to open {} for GPU timings", path);
+    return;
+  }
+  csv_ << "frame,scope,gpu_ms\n";
+}
+
+void GpuProfiler::StopCsv() { csv_.close(); }
+
+}  // namespace gl
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <array>
+#include <fstream>
+
+namespace gl {
+
+// Times GPU work with GL_TIMESTAMP queries. Each scope owns a ring of query pairs so results are
+// read back a few frames after they were issued, once they are available, without stalling. If
+// the GPU falls further behind than the ring, samples are dropped instead of waiting.
+class GpuProfiler {
+ public:
+  static constexpr uint32_t kQueryRingSize = 4;
+  static constexpr uint32_t kHistorySize = 128;
+
+  struct Scope {
+    std::string name;
+    // rolling window of results, oldest at history_offset
+    std::array<float, kHistorySize> history_ms{};
+    uint32_t history_offset{0};
+    float average_ms{0};
+
+   private:
+    friend class GpuProfiler;
+    // start and end timestamp query per ring slot
+    std::array<uint32_t, kQueryRingSize * 2> queries{};
+    std::array<uint64_t, kQueryRingSize> frames{};
+    std::array<bool, kQueryRingSize> pending{};
+    uint32_t write_index{0};
+    bool recording{false};
+  };
+
+  static void Init();
+  static void Shutdown();
+  static GpuProfiler& Get();
+  static bool IsInitialized() { return instance_ != nullptr; }
+
+  void Begin(std::string_view name);
+  void End(std::string_view name);
+  // Collects every finished query. Call once per frame.
+  void Update();
+  [[nodiscard]] const std::vector<Scope>& GetScopes() const { return scopes_; }
+
+  // Appends frame,scope,gpu_ms rows for each collected sample.
+  void StartCsv(const std::string& path);
+  void StopCsv();
+  [[nodiscard]] bool IsWritingCsv() const { return csv_.is_open(); }
+
+ private:
+  static GpuProfiler* instance_;
+  GpuProfiler();
+  ~GpuProfiler();
+  Scope& FindOrAddScope(std::string_view name);
+  void Collect(Scope& scope);
+
+  std::vector<Scope> scopes_;
+  std::ofstream csv_;
+  uint64_t frame_{0};
+};
+
+// Times the enclosing block. Does nothing if the profiler isn't initialized.
+class GpuScope {
+ public:
+  explicit GpuScope(std::string_view name) : name_(name) {
+    if (GpuProfiler::IsInitialized()) GpuProfiler::Get().Begin(name_);
+  }
+  ~GpuScope() {
+    if (GpuProfiler::IsInitialized()) GpuProfiler::Get().End(name_);
+  }
+  GpuScope(const GpuScope& other) = delete;
+  GpuScope& operator=(const GpuScope& other) = delete;
+
+ private:
+  std::string_view name_;
+};
+
+}  // namespace gl
@@ -0,0 +1,64 @@
+#include "RingBuffer.hpp"
+
+namespace gl {
+
+namespace {
+constexpr uint32_t kRegionAlignment = 256;
+}  // namespace
+
+RingBuffer::~RingBuffer() { DeleteFences(); }
+
+void RingBuffer::DeleteFences() {
+  for (GLsync& fence : fences_) {
+    if (fence) glDeleteSync(fence);
+    fence = nullptr;
+  }
+}
+
+void RingBuffer::Init(uint32_t region_size_bytes) {
+  DeleteFences();
+  // Region starts stay aligned for any binding, offset alignments are at most 256 in practice.
+  region_size_ = (region_size_bytes + kRegionAlignment - 1) / kRegionAlignment * kRegionAlignment;
+  region_ = 0;
+  region_offset_ = 0;
+  GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+  buffer_.Init(region_size_ * kRegions, flags);
+  data_ = static_cast<std::byte*>(buffer_.MapRange(0, region_size_ * kRegions, flags));
+}
+
+void RingBuffer::BeginRegion() {
+  EASSERT_MSG(data_ != nullptr, "Ring buffer isn't initialized");
+  region_ = (region_ + 1) % kRegions;
+  region_offset_ = 0;
+  GLsync& fence = fences_[region_];
+  if (!fence) return;
+  // only flush on the first wait, the fence is already queued after that
+  GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+  constexpr GLuint64 kWaitNs = 1000000;
+  while (true) {
+    GLenum result = glClientWaitSync(fence, flags, kWaitNs);
+    if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED) break;
+    if (result == GL_WAIT_FAILED) {
+      spdlog::error("Waiting for ring buffer region failed");
+      break;
+    }
+    flags = 0;
+  }
+  glDeleteSync(fence);
+  fence = nullptr;
+}
+
+std::optional<uint32_t> RingBuffer::Allocate(uint32_t size_bytes, uint32_t alignment) {
+  uint32_t offset = (region_offset_ + alignment - 1) / alignment * alignment;
+  if (offset + size_bytes > region_size_) return std::nullopt;
+  region_offset_ = offset + size_bytes;
+  return region_ * region_size_ + offset;
+}
+
+void RingBuffer::EndRegion() {
+  GLsync& fence = fences_[region_];
+  if (fence) glDeleteSync(fence);
+  fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+}  // namespace gl
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <array>
+
+#include "Buffer.hpp"
+
+namespace gl {
+
+// Persistently mapped upload buffer split into kRegions regions. Each region is fenced once the
+// commands reading it are queued and only rewritten after the fence signals, so writes go
+// straight into GPU visible memory and only wait if the GPU falls kRegions regions behind.
+// Allocations are bound with Buffer::BindRange, so one ring can feed any number of bindings.
+class RingBuffer {
+ public:
+  static constexpr uint32_t kRegions = 3;
+
+  RingBuffer() = default;
+  RingBuffer(const RingBuffer& other) = delete;
+  RingBuffer& operator=(const RingBuffer& other) = delete;
+  ~RingBuffer();
+
+  // Creates the buffer, or replaces it when called again. Commands already queued keep reading
+  // the old buffer, which the driver frees once they finish.
+  void Init(uint32_t region_size_bytes);
+  // Starts writing the next region, waiting for the GPU to finish reading it first.
+  void BeginRegion();
+  // Reserves size_bytes in the current region at a multiple of alignment and returns its offset
+  // in the buffer, or nullopt if the region is full.
+  std::optional<uint32_t> Allocate(uint32_t size_bytes, uint32_t alignment);
+  // Fences the current region. Call after the last command reading it has been issued.
+  void EndRegion();
+
+  // Mapped memory at offset, written without any GL call.
+  [[nodiscard]] std::byte* Data(uint32_t offset) const { return data_ + offset; }
+  [[nodiscard]] const Buffer& GetBuffer() const { return buffer_; }
+  [[nodiscard]] uint32_t RegionSize() const { return region_size_; }
+
+ private:
+  void DeleteFences();
+
+  Buffer buffer_;
+  std::byte* data_{nullptr};
+  uint32_t region_size_{0};
+  uint32_t region_{0};
+  // next free byte of the current region, relative to its start
+  uint32_t region_offset_{0};
+  std::array<GLsync, kRegions> fences_{};
+};
+
+}  // namespace gl
@@ -9,14 +9,26 @@ void Shader::Bind() const {
 
 void Shader::Unbind() { glUseProgram(0); }
 
-void Shader::SetInt(const std::string& name, int value) {
-  EASSERT_MSG(uniform_locations_.contains(name), "Uniform name not found");
-  glUniform1i(uniform_locations_[name], value);
+GLint Shader::GetUniformLocation(std::string_view name) const {
+  auto it = uniform_locations_.find(name);
+  EASSERT_MSG(it != uniform_locations_.end(), "Uniform name not found");
+  return it == uniform_locations_.end() ? -1 : static_cast<GLint>(it->second);
 }
 
-void Shader::SetFloat(const std::string& name, float value) {
-  EASSERT_MSG(uniform_locations_.contains(name), "Uniform name not found");
-  glUniform1f(uniform_locations_[name], value);
+void Shader::SetInt(GLint location, int value) { glUniform1i(location, value); }
+
+void Shader::SetUInt(GLint location, uint32_t value) { glUniform1ui(location, value); }
+
+void Shader::SetFloat(GLint location, float value) { glUniform1f(location, value); }
+
+void Shader::SetInt(std::string_view name, int value) { SetInt(GetUniformLocation(name), value); }
+
+void Shader::SetUInt(std::string_view name, uint32_t value) {
+  SetUInt(GetUniformLocation(name), value);
+}
+
+void Shader::SetFloat(std::string_view name, float value) {
+  SetFloat(GetUniformLocation(name), value);
 }
 
 // void Shader::SetMat4(const std::string& name, const glm::mat4& mat) {
@@ -60,17 +72,15 @@ void Shader::SetFloat(const std::string& name, float value) {
 //                      glm::value_ptr(mat));
 // }
 
-void Shader::SetFloatArr(const std::string& name, GLuint count, const GLfloat* value) {
-  EASSERT_MSG(uniform_locations_.contains(name), "Uniform name not found");
-  glUniform1fv(uniform_locations_[name], count, value);
+void Shader::SetFloatArr(std::string_view name, GLuint count, const GLfloat* value) {
+  glUniform1fv(GetUniformLocation(name), count, value);
 }
 
-void Shader::SetBool(const std::string& name, bool value) {
-  EASSERT_MSG(uniform_locations_.contains(name), "Uniform name not found");
-  glUniform1i(uniform_locations_[name], static_cast<GLint>(value));
+void Shader::SetBool(std::string_view name, bool value) {
+  glUniform1i(GetUniformLocation(name), static_cast<GLint>(value));
 }
 
-Shader::Shader(uint32_t id, std::unordered_map<std::string, uint32_t>& uniform_locations)
+Shader::Shader(uint32_t id, UniformLocations& uniform_locations)
     : id_(id), uniform_locations_(uniform_locations) {}
 
 }  // namespace gl
@@ -5,13 +5,30 @@ namespace gl {
 // Lightweight object containing id and reference to uniform locations stored in the manager.
 // This is a wrapper to access the shader and set uniforms
 using Float4Arr = float[4];
+
+struct UniformNameHash {
+  using is_transparent = void;
+  size_t operator()(std::string_view name) const { return std::hash<std::string_view>{}(name); }
+};
+// Uniform locations by name. Lookups take any string_view, so no std::string is built per call.
+using UniformLocations =
+    std::unordered_map<std::string, uint32_t, UniformNameHash, std::equal_to<>>;
+
 class Shader {
  public:
   void Bind() const;
   static void Unbind();
 
-  void SetInt(const std::string& name, int value);
-  void SetFloat(const std::string& name, float value);
+  // Resolve locations once and pass them to the setters below in hot loops, instead of a name
+  // lookup per call.
+  [[nodiscard]] GLint GetUniformLocation(std::string_view name) const;
+  static void SetInt(GLint location, int value);
+  static void SetUInt(GLint location, uint32_t value);
+  static void SetFloat(GLint location, float value);
+
+  void SetInt(std::string_view name, int value);
+  void SetUInt(std::string_view name, uint32_t value);
+  void SetFloat(std::string_view name, float value);
   // void SetMat4(const std::string& name, const glm::mat4& mat);
   // void SetIVec2(const std::string& name, const glm::ivec2& vec);
   // void SetIVec3(const std::string& name, const glm::ivec3& vec);
@@ -20,16 +37,16 @@ class Shader {
   // void SetVec4(const std::string& name, const glm::vec4& vec);
   // void SetVec4(const std::string& name, const Float4Arr& vec);
   // void SetMat3(const std::string& name, const glm::mat3& mat, bool transpose = false);
-  void SetBool(const std::string& name, bool value);
-  void SetFloatArr(const std::string& name, GLuint count, const GLfloat* value);
+  void SetBool(std::string_view name, bool value);
+  void SetFloatArr(std::string_view name, GLuint count, const GLfloat* value);
 
-  Shader(uint32_t id, std::unordered_map<std::string, uint32_t>& uniform_locations);
+  Shader(uint32_t id, UniformLocations& uniform_locations);
   ~Shader() = default;
   [[nodiscard]] inline uint32_t Id() const { return id_; }
 
  private:
   uint32_t id_{0};
-  std::unordered_map<std::string, uint32_t>& uniform_locations_;
+  UniformLocations& uniform_locations_;
 };
 
 }  // namespace gl
@@ -1,5 +1,6 @@
 #include "ShaderManager.hpp"
 
+#include <filesystem>
 #include <fstream>
 
 namespace gl {
@@ -15,6 +16,38 @@ std::optional<std::string> LoadFromFile(const std::string &path) {
   }
   return s_stream.str();
 }
+
+constexpr int kMaxIncludeDepth = 8;
+
+// Copies the rest of file_stream into s_stream, replacing #include "file" lines with the contents
+// of the file, resolved relative to dir.
+bool AppendWithIncludes(std::ifstream &file_stream, const std::filesystem::path &dir,
+                        std::stringstream &s_stream, int depth) {
+  std::string line;
+  while (std::getline(file_stream, line)) {
+    if (!line.starts_with("#include")) {
+      s_stream << line << '\n';
+      continue;
+    }
+    size_t begin = line.find('"');
+    size_t end = line.rfind('"');
+    if (begin == std::string::npos || end == begin) {
+      spdlog::error("Malformed include: {}", line);
+      return false;
+    }
+    std::filesystem::path include_path = dir / line.substr(begin + 1, end - begin - 1);
+    std::ifstream include_stream(include_path);
+    if (!include_stream.is_open() || depth >= kMaxIncludeDepth) {
+      spdlog::error("Failed to include {}", include_path.string());
+      return false;
+    }
+    if (!AppendWithIncludes(include_stream, include_path.parent_path(), s_stream, depth + 1)) {
+      return false;
+    }
+  }
+  return true;
+}
+
 std::optional<std::string> LoadFromFile(
     const std::string &path, const std::vector<std::pair<std::string, std::string>> &defines) {
   std::ifstream file_stream(path);
@@ -27,20 +60,54 @@ std::optional<std::string> LoadFromFile(
   for (const auto &[name, def] : defines) {
     s_stream << "#define " << name << ' ' << def << '\n';
   }
-  while (std::getline(file_stream, line)) {
-    s_stream << line << '\n';
+  if (!AppendWithIncludes(file_stream, std::filesystem::path(path).parent_path(), s_stream, 0)) {
+    return std::nullopt;
   }
   return s_stream.str();
 }
+// FNV-1a, continuing from hash
+uint64_t HashBytes(std::string_view bytes, uint64_t hash = 14695981039346656037ull) {
+  for (char c : bytes) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+  }
+  return hash;
+}
 }  // namespace util
 
+namespace {
+
+// Header of a cached program binary, followed by length bytes of the binary.
+struct ProgramBinaryHeader {
+  uint32_t magic;
+  uint32_t format;
+  uint64_t key;
+  uint64_t length;
+};
+constexpr uint32_t kProgramBinaryMagic = 0x42505253;  // "SRPB"
+
+std::string GlString(GLenum name) {
+  const auto *str = reinterpret_cast<const char *>(glGetString(name));
+  return str ? str : "";
+}
+
+}  // namespace
+
+DefineSet::DefineSet() : hash_(util::HashBytes("")) {}
+
+DefineSet::DefineSet(ShaderDefines defines)
+    : defines_(std::move(defines)), hash_(util::HashBytes("")) {
+  for (const auto &[name, def] : defines_) {
+    hash_ = util::HashBytes(name + '=' + def + '\n', hash_);
+  }
+}
+
 ShaderManager *ShaderManager::instance_ = nullptr;
 
 ShaderManager &ShaderManager::Get() { return *instance_; }
 
-void ShaderManager::Init() {
+void ShaderManager::Init(std::filesystem::path binary_cache_dir) {
   EASSERT_MSG(instance_ == nullptr, "Can't make two instances");
-  instance_ = new ShaderManager;
+  instance_ = new ShaderManager(std::move(binary_cache_dir));
 }
 
 void ShaderManager::Shutdown() {
@@ -48,35 +115,85 @@ void ShaderManager::Shutdown() {
   delete instance_;
 }
 
-ShaderManager::ShaderManager() {
+ShaderManager::ShaderManager(std::filesystem::path binary_cache_dir) {
   EASSERT_MSG(instance_ == nullptr, "Cannot create two instances.");
   instance_ = this;
+  driver_id_ = GlString(GL_VENDOR) + '\n' + GlString(GL_RENDERER) + '\n' + GlString(GL_VERSION);
+  // let the driver compile on as many threads as it likes
+  if (GLEW_KHR_parallel_shader_compile) {
+    glMaxShaderCompilerThreadsKHR(0xffffffff);
+    parallel_compile_ = true;
+  } else if (GLEW_ARB_parallel_shader_compile) {
+    glMaxShaderCompilerThreadsARB(0xffffffff);
+    parallel_compile_ = true;
+  }
+  if (binary_cache_dir.empty()) return;
+  GLint num_formats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+  if (num_formats == 0) {
+    spdlog::info("Driver has no program binary formats, shader cache disabled");
+    return;
+  }
+  std::error_code ec;
+  std::filesystem::create_directories(binary_cache_dir, ec);
+  if (ec) {
+    spdlog::error("Failed to create shader cache {}: {}", binary_cache_dir.string(),
+                  ec.message());
+    return;
+  }
+  binary_cache_dir_ = std::move(binary_cache_dir);
 }
 
-std::optional<Shader> ShaderManager::GetShader(const std::string &name) {
+std::optional<Shader> ShaderManager::GetShader(const std::string &name,
+                                              const DefineSet &defines) {
   auto it = shader_data_.find(name);
   if (it == shader_data_.end()) {
     spdlog::error("Shader not found {}", name.data());
     return std::nullopt;
   }
-  return Shader{it->second.program_id, it->second.uniform_locations};
+  auto &permutations = it->second.permutations;
+  auto permutation_it = permutations.find(defines.Hash());
+  if (permutation_it == permutations.end()) {
+    std::vector<ShaderCreateInfo> create_info_vec = it->second.create_info_vec;
+    for (auto &create_info : create_info_vec) {
+      std::ranges::copy(defines.Defines(), std::back_inserter(create_info.defines));
+    }
+    auto result = CompileProgram(name, create_info_vec);
+    if (!result.has_value()) return std::nullopt;
+    permutation_it = permutations.emplace(defines.Hash(), std::move(result.value())).first;
+  }
+  return Shader{permutation_it->second.program_id, permutation_it->second.uniform_locations};
 }
 
 std::optional<Shader> ShaderManager::AddShader(
     const std::string &name, const std::vector<ShaderCreateInfo> &create_info_vec) {
   auto existing_it = shader_data_.find(name);
   if (existing_it != shader_data_.end()) {
-    glDeleteProgram(existing_it->second.program_id);
+    for (auto &[hash, data] : existing_it->second.permutations) glDeleteProgram(data.program_id);
     shader_data_.erase(name);
   }
+  // a pending recompile would replace the new program with one from the old create info
+  DiscardPendingPrograms(name);
 
   auto result = ShaderManager::CompileProgram(name, create_info_vec);
   if (!result.has_value()) {
     return std::nullopt;
   }
   // spdlog::info("Compiled shader: {}, Id: {}", name, result->program_id);
-  shader_data_.emplace(name.data(), result.value());
-  return Shader{result->program_id, result->uniform_locations};
+  generation_++;
+  ShaderEntry &entry = shader_data_[name];
+  entry.create_info_vec = create_info_vec;
+  ShaderProgramData &data =
+      entry.permutations.emplace(DefineSet{}.Hash(), std::move(result.value())).first->second;
+  return Shader{data.program_id, data.uniform_locations};
+}
+
+void ShaderManager::DiscardPendingPrograms(const std::string &name) {
+  std::erase_if(pending_programs_, [&](PendingProgram &pending) {
+    if (pending.name != name) return false;
+    DiscardProgram(pending);
+    return true;
+  });
 }
 
 bool CheckShaderModuleCompilationSuccess(uint32_t shader_id, const char *shaderPath) {
@@ -95,7 +212,6 @@ static constexpr GLenum kShaderTypeToGl[] = {GL_VERTEX_SHADER, GL_FRAGMENT_SHADE
                                              GL_GEOMETRY_SHADER, GL_COMPUTE_SHADER};
 
 bool CheckProgramLinkSuccess(GLuint id) {
-  glLinkProgram(id);
   int success;
   glGetProgramiv(id, GL_LINK_STATUS, &success);
   if (!success) {
@@ -114,54 +230,189 @@ uint32_t CompileShader(ShaderType type, const char *src) {
   return id;
 }
 
-std::optional<ShaderManager::ShaderProgramData> ShaderManager::CompileProgram(
-    const std::string &name, const std::vector<ShaderCreateInfo> &create_info_vec) {
-  std::vector<uint32_t> shader_ids;
+std::optional<uint64_t> ShaderManager::LoadSources(
+    const std::vector<ShaderCreateInfo> &create_info_vec, std::vector<std::string> &srcs) const {
+  uint64_t key = util::HashBytes(driver_id_);
   for (const auto &create_info : create_info_vec) {
     auto src = util::LoadFromFile(create_info.shaderPath, create_info.defines);
     if (!src.has_value()) {
       spdlog::error("Failed to load from file {}", create_info.shaderPath);
       return std::nullopt;
     }
-    uint32_t shader_id = CompileShader(create_info.shaderType, src.value().c_str());
-    if (!CheckShaderModuleCompilationSuccess(shader_id, create_info.shaderPath.c_str())) {
-      spdlog::error("error: {}", create_info.shaderPath.c_str());
-      return std::nullopt;
+    key = util::HashBytes(std::to_string(static_cast<int>(create_info.shaderType)), key);
+    for (const auto &[define_name, def] : create_info.defines) {
+      key = util::HashBytes(define_name + '=' + def + '\n', key);
     }
-    shader_ids.push_back(shader_id);
+    key = util::HashBytes(src.value(), key);
+    srcs.emplace_back(std::move(src.value()));
   }
+  return key;
+}
 
-  uint32_t program_id = glCreateProgram();
-  for (auto &shader_id : shader_ids) {
-    glAttachShader(program_id, shader_id);
+ShaderManager::PendingProgram ShaderManager::BeginProgram(
+    const std::string &name, uint64_t permutation,
+    const std::vector<ShaderCreateInfo> &create_info_vec, const std::vector<std::string> &srcs,
+    uint64_t key) {
+  PendingProgram pending;
+  pending.name = name;
+  pending.permutation = permutation;
+  pending.create_info_vec = create_info_vec;
+  pending.key = key;
+  pending.program_id = binary_cache_dir_.empty() ? 0 : LoadProgramBinary(name, key);
+  if (pending.program_id != 0) return pending;
+
+  // No status is queried here, that would wait for the driver to finish.
+  for (size_t i = 0; i < create_info_vec.size(); i++) {
+    pending.shader_ids.push_back(CompileShader(create_info_vec[i].shaderType, srcs[i].c_str()));
   }
-  glLinkProgram(program_id);
-  if (!CheckProgramLinkSuccess(program_id)) {
-    return std::nullopt;
+  pending.program_id = glCreateProgram();
+  for (auto &shader_id : pending.shader_ids) {
+    glAttachShader(pending.program_id, shader_id);
+  }
+  if (!binary_cache_dir_.empty()) {
+    glProgramParameteri(pending.program_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  }
+  glLinkProgram(pending.program_id);
+  return pending;
+}
+
+bool ShaderManager::IsProgramReady(const PendingProgram &pending) const {
+  if (pending.shader_ids.empty() || !parallel_compile_) return true;
+  int done;
+  glGetProgramiv(pending.program_id, GL_COMPLETION_STATUS_KHR, &done);
+  return done;
+}
+
+void ShaderManager::DiscardProgram(PendingProgram &pending) {
+  for (auto &shader_id : pending.shader_ids) glDeleteShader(shader_id);
+  glDeleteProgram(pending.program_id);
+}
+
+std::optional<ShaderManager::ShaderProgramData> ShaderManager::FinishProgram(
+    PendingProgram &pending) {
+  if (!pending.shader_ids.empty()) {
+    for (size_t i = 0; i < pending.shader_ids.size(); i++) {
+      if (!CheckShaderModuleCompilationSuccess(pending.shader_ids[i],
+                                               pending.create_info_vec[i].shaderPath.c_str())) {
+        spdlog::error("error: {}", pending.create_info_vec[i].shaderPath.c_str());
+        DiscardProgram(pending);
+        return std::nullopt;
+      }
+    }
+    if (!CheckProgramLinkSuccess(pending.program_id)) {
+      DiscardProgram(pending);
+      return std::nullopt;
+    }
+    // the program keeps what it needs from the shaders
+    for (auto &shader_id : pending.shader_ids) {
+      glDetachShader(pending.program_id, shader_id);
+      glDeleteShader(shader_id);
+    }
+    if (!binary_cache_dir_.empty()) {
+      SaveProgramBinary(pending.name, pending.key, pending.program_id);
+    }
   }
 
   ShaderProgramData data;
-  data.program_id = program_id;
-  data.name = name;
-  data.create_info_vec = create_info_vec;
+  data.program_id = pending.program_id;
+  data.name = pending.name;
+  data.create_info_vec = std::move(pending.create_info_vec);
+  data.key = pending.key;
   data.InitializeUniforms();
   return data;
 }
 
+std::optional<ShaderManager::ShaderProgramData> ShaderManager::CompileProgram(
+    const std::string &name, const std::vector<ShaderCreateInfo> &create_info_vec) {
+  // The sources are read even on a cache hit, they are the key.
+  std::vector<std::string> srcs;
+  std::optional<uint64_t> key = LoadSources(create_info_vec, srcs);
+  if (!key.has_value()) return std::nullopt;
+  // never queued, so the permutation is unused
+  PendingProgram pending = BeginProgram(name, 0, create_info_vec, srcs, key.value());
+  return FinishProgram(pending);
+}
+
+uint32_t ShaderManager::LoadProgramBinary(const std::string &name, uint64_t key) {
+  std::filesystem::path path = binary_cache_dir_ / fmt::format("{}_{:016x}.bin", name, key);
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) return 0;
+  std::error_code ec;
+  uintmax_t file_size = std::filesystem::file_size(path, ec);
+  ProgramBinaryHeader header{};
+  file.read(reinterpret_cast<char *>(&header), sizeof(header));
+  // an entry is the header and exactly length bytes of binary, checked before allocating them
+  if (!file || ec || header.magic != kProgramBinaryMagic || header.key != key ||
+      header.length != file_size - sizeof(header)) {
+    spdlog::warn("Ignoring malformed shader cache entry {}", path.string());
+    return 0;
+  }
+  std::vector<char> binary(header.length);
+  file.read(binary.data(), static_cast<std::streamsize>(binary.size()));
+  if (!file) {
+    spdlog::warn("Ignoring truncated shader cache entry {}", path.string());
+    return 0;
+  }
+
+  uint32_t program_id = glCreateProgram();
+  glProgramBinary(program_id, header.format, binary.data(), static_cast<GLsizei>(binary.size()));
+  int success;
+  glGetProgramiv(program_id, GL_LINK_STATUS, &success);
+  if (!success) {
+    // usually a driver update that kept its version string
+    spdlog::info("Driver rejected cached binary of {}, recompiling", name);
+    glDeleteProgram(program_id);
+    return 0;
+  }
+  return program_id;
+}
+
+void ShaderManager::SaveProgramBinary(const std::string &name, uint64_t key,
+                                      uint32_t program_id) {
+  GLint length = 0;
+  glGetProgramiv(program_id, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) return;
+  std::vector<char> binary(length);
+  GLenum format;
+  glGetProgramBinary(program_id, length, nullptr, &format, binary.data());
+  ProgramBinaryHeader header{
+      .magic = kProgramBinaryMagic, .format = format, .key = key, .length = binary.size()};
+
+  // written to a temporary first, so another instance never reads half a binary
+  std::filesystem::path path = binary_cache_dir_ / fmt::format("{}_{:016x}.bin", name, key);
+  std::filesystem::path tmp_path = path;
+  tmp_path += ".tmp";
+  {
+    std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(binary.data(), static_cast<std::streamsize>(binary.size()));
+    if (!file) {
+      spdlog::warn("Failed to write shader cache entry {}", tmp_path.string());
+      return;
+    }
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmp_path, path, ec);
+  if (ec) spdlog::warn("Failed to write shader cache entry {}: {}", path.string(), ec.message());
+}
+
 std::optional<Shader> ShaderManager::RecompileShader(const std::string &name) {
   auto it = shader_data_.find(name);
   if (it == shader_data_.end()) {
     spdlog::warn("Shader not found, cannot recompile: {}", name.data());
     return std::nullopt;
   }
-  auto recompile_result = CompileProgram(name, it->second.create_info_vec);
-  if (!recompile_result.has_value()) {
-    return std::nullopt;
+  for (auto &[hash, data] : it->second.permutations) {
+    auto recompile_result = CompileProgram(name, data.create_info_vec);
+    if (!recompile_result.has_value()) continue;
+    glDeleteProgram(data.program_id);
+    data = std::move(recompile_result.value());
+    generation_++;
   }
   spdlog::info("Shader recompiled: {}", name.data());
-  shader_data_.erase(it);
-  auto new_it = shader_data_.emplace(name, recompile_result.value());
-  return Shader{new_it.first->second.program_id, new_it.first->second.uniform_locations};
+  auto base_it = it->second.permutations.find(DefineSet{}.Hash());
+  if (base_it == it->second.permutations.end()) return std::nullopt;
+  return Shader{base_it->second.program_id, base_it->second.uniform_locations};
 }
 
 void ShaderManager::ShaderProgramData::InitializeUniforms() {
@@ -183,12 +434,62 @@ void ShaderManager::ShaderProgramData::InitializeUniforms() {
   }
 }
 
+void ShaderManager::RecompileShadersAsync() {
+  for (auto &[name, entry] : shader_data_) {
+    for (auto &[permutation, data] : entry.permutations) {
+      std::vector<std::string> srcs;
+      std::optional<uint64_t> key = LoadSources(data.create_info_vec, srcs);
+      // the last good program stays in use
+      if (!key.has_value()) continue;
+      auto pending_it = std::ranges::find_if(pending_programs_, [&](const PendingProgram &p) {
+        return p.permutation == permutation && p.name == name;
+      });
+      if (pending_it != pending_programs_.end()) {
+        if (pending_it->key == key.value()) continue;
+        DiscardProgram(*pending_it);
+        pending_programs_.erase(pending_it);
+      } else if (data.key == key.value()) {
+        continue;
+      }
+      pending_programs_.emplace_back(
+          BeginProgram(name, permutation, data.create_info_vec, srcs, key.value()));
+    }
+  }
+}
+
+void ShaderManager::PollPendingPrograms() {
+  // Without parallel compiles, finishing a program waits for the driver, so only one program
+  // is finished per call.
+  bool finished_one = false;
+  std::erase_if(pending_programs_, [&](PendingProgram &pending) {
+    if ((finished_one && !parallel_compile_) || !IsProgramReady(pending)) return false;
+    finished_one = true;
+    std::optional<ShaderProgramData> result = FinishProgram(pending);
+    if (!result.has_value()) return true;
+    ShaderProgramData *data = nullptr;
+    auto it = shader_data_.find(pending.name);
+    if (it != shader_data_.end()) {
+      auto permutation_it = it->second.permutations.find(pending.permutation);
+      if (permutation_it != it->second.permutations.end()) data = &permutation_it->second;
+    }
+    if (!data) {
+      glDeleteProgram(result->program_id);
+      return true;
+    }
+    glDeleteProgram(data->program_id);
+    *data = std::move(result.value());
+    generation_++;
+    spdlog::info("Shader recompiled: {}", pending.name);
+    return true;
+  });
+}
+
 void ShaderManager::RecompileShaders() {
   // have to avoid iterator invalidation
   std::vector<std::string> shader_names;
   shader_names.reserve(shader_data_.size());
   for (auto &shader_data : shader_data_) {
-    shader_names.emplace_back(shader_data.second.name.data());
+    shader_names.emplace_back(shader_data.first);
   }
   for (const auto &shader_name : shader_names) {
     RecompileShader(shader_name);
@@ -1,43 +1,123 @@
 #pragma once
 
+#include <filesystem>
+
 #include "Shader.hpp"
 
 namespace gl {
 enum class ShaderType { kVertex, kFragment, kGeometry, kCompute };
 
+using ShaderDefines = std::vector<std::pair<std::string, std::string>>;
+
 struct ShaderCreateInfo {
   std::string shaderPath;
   ShaderType shaderType;
-  std::vector<std::pair<std::string, std::string>> defines;
+  ShaderDefines defines;
+};
+
+// Defines added to every stage of a shader to select one of its permutations. The hash is
+// computed once on construction, so looking up a permutation never touches the strings. Build
+// them up front and keep them, not once per lookup.
+class DefineSet {
+ public:
+  DefineSet();
+  explicit DefineSet(ShaderDefines defines);
+  [[nodiscard]] const ShaderDefines& Defines() const { return defines_; }
+  [[nodiscard]] uint64_t Hash() const { return hash_; }
+
+ private:
+  ShaderDefines defines_;
+  uint64_t hash_;
 };
 
 class ShaderManager {
  public:
-  static void Init();
+  // Linked programs are cached as driver binaries in binary_cache_dir, keyed by their
+  // preprocessed sources and the driver. An empty path disables the cache.
+  static void Init(std::filesystem::path binary_cache_dir = {});
   static void Shutdown();
   static ShaderManager& Get();
-  std::optional<Shader> GetShader(const std::string& name);
+  // Returns the permutation of name with the given defines added, compiling it on first use.
+  // Permutations stay cached until AddShader replaces name.
+  std::optional<Shader> GetShader(const std::string& name, const DefineSet& defines = {});
+  // Adds or replaces name and compiles its permutation without extra defines.
   std::optional<Shader> AddShader(const std::string& name,
                                   const std::vector<ShaderCreateInfo>& create_info_vec);
+  // Recompiles every permutation of name and returns the one without extra defines.
   std::optional<Shader> RecompileShader(const std::string& name);
   void RecompileShaders();
+  // Issues compiles for every program whose sources changed and returns without waiting for
+  // them. The old programs stay in use until PollPendingPrograms swaps in the new ones.
+  void RecompileShadersAsync();
+  // Swaps in the programs of RecompileShadersAsync that finished linking. Call once per frame.
+  void PollPendingPrograms();
+  // Changes whenever a program is replaced. A Shader kept across frames has to be fetched again
+  // when it does.
+  [[nodiscard]] uint64_t Generation() const { return generation_; }
+  // GL vendor, renderer and version, one per line. Identifies the driver results were measured on.
+  [[nodiscard]] const std::string& DriverId() const { return driver_id_; }
 
  private:
   static ShaderManager* instance_;
-  ShaderManager();
+  explicit ShaderManager(std::filesystem::path binary_cache_dir);
 
+  // One linked permutation of a shader.
   struct ShaderProgramData {
     std::string name;
     uint32_t program_id;
-    std::unordered_map<std::string, uint32_t> uniform_locations;
+    UniformLocations uniform_locations;
+    // with the permutation's defines added
     std::vector<ShaderCreateInfo> create_info_vec;
+    // hash of the preprocessed sources and the driver
+    uint64_t key;
 
     void InitializeUniforms();
   };
 
+  struct ShaderEntry {
+    // without permutation defines
+    std::vector<ShaderCreateInfo> create_info_vec;
+    // by DefineSet::Hash
+    std::unordered_map<uint64_t, ShaderProgramData> permutations;
+  };
+
+  // A program whose compile and link were issued but not checked yet. shader_ids is empty for a
+  // program loaded from the binary cache.
+  struct PendingProgram {
+    std::string name;
+    uint64_t permutation;
+    uint32_t program_id;
+    std::vector<uint32_t> shader_ids;
+    std::vector<ShaderCreateInfo> create_info_vec;
+    uint64_t key;
+  };
+
+  // Preprocesses the sources into srcs and returns their key.
+  std::optional<uint64_t> LoadSources(const std::vector<ShaderCreateInfo>& create_info_vec,
+                                      std::vector<std::string>& srcs) const;
+  PendingProgram BeginProgram(const std::string& name, uint64_t permutation,
+                              const std::vector<ShaderCreateInfo>& create_info_vec,
+                              const std::vector<std::string>& srcs, uint64_t key);
+  // True once checking the program won't wait for the driver.
+  [[nodiscard]] bool IsProgramReady(const PendingProgram& pending) const;
+  std::optional<ShaderProgramData> FinishProgram(PendingProgram& pending);
+  static void DiscardProgram(PendingProgram& pending);
+
   std::optional<ShaderProgramData> CompileProgram(
       const std::string& name, const std::vector<ShaderCreateInfo>& create_info_vec);
-  std::unordered_map<std::string, ShaderProgramData> shader_data_;
+  // Returns 0 on a miss or when the driver rejects the cached binary.
+  uint32_t LoadProgramBinary(const std::string& name, uint64_t key);
+  void SaveProgramBinary(const std::string& name, uint64_t key, uint32_t program_id);
+  void DiscardPendingPrograms(const std::string& name);
+  std::unordered_map<std::string, ShaderEntry> shader_data_;
+  std::vector<PendingProgram> pending_programs_;
+  // GL_KHR_parallel_shader_compile or its ARB twin
+  bool parallel_compile_{false};
+  uint64_t generation_{0};
+  // empty when the cache is disabled or the driver has no binary formats
+  std::filesystem::path binary_cache_dir_;
+  // vendor, renderer and version strings, binaries from another driver are never loaded
+  std::string driver_id_;
 };
 
 }  // namespace gl
@@ -12,8 +12,13 @@ Texture::~Texture() {
 
 void Texture::Load(const Tex2DCreateInfoEmpty& params) {
   dims_ = params.dims;
-  glCreateTextures(GL_TEXTURE_2D, 1, &id_);
-  glTextureStorage2D(id_, 1, params.internal_format, dims_.x, dims_.y);
+  if (params.layers > 0) {
+    glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &id_);
+    glTextureStorage3D(id_, 1, params.internal_format, dims_.x, dims_.y, params.layers);
+  } else {
+    glCreateTextures(GL_TEXTURE_2D, 1, &id_);
+    glTextureStorage2D(id_, 1, params.internal_format, dims_.x, dims_.y);
+  }
   glTextureParameteri(id_, GL_TEXTURE_WRAP_S, params.wrap_s);
   glTextureParameteri(id_, GL_TEXTURE_WRAP_T, params.wrap_t);
   glTextureParameteri(id_, GL_TEXTURE_MIN_FILTER, params.min_filter);
@@ -9,6 +9,8 @@ struct Tex2DCreateInfoEmpty {
   GLuint internal_format;
   GLuint min_filter{GL_LINEAR};
   GLuint mag_filter{GL_LINEAR};
+  // 0 for a GL_TEXTURE_2D, otherwise the layers of a GL_TEXTURE_2D_ARRAY
+  int layers{0};
 };
 
 class Texture {
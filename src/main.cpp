@@ -1,5 +1,11 @@
 #include "App.hpp"
-int main() {
+#include "Bench.hpp"
+
+int main(int argc, char* argv[]) {
+  if (sand::IsBenchCommand(argc, argv)) {
+    return sand::RunBench(argc, argv);
+  }
   sand::App app{};
   app.Run();
+  return 0;
 }
@@ -0,0 +1,360 @@
+#include "BatchSim.hpp"
+
+#include "ThreadPool.hpp"
+#include "gl/Buffer.hpp"
+#include "gl/RingBuffer.hpp"
+#include "gl/ShaderManager.hpp"
+#include "gl/Texture.hpp"
+#include "sand_sim/Cell.hpp"
+#include "sand_sim/Chunk.hpp"
+#include "sand_sim/CpuSim.hpp"
+#include "sand_sim/GpuSim.hpp"
+
+namespace sand {
+
+namespace {
+
+// Mirrors the std430 WorldParams struct in sim_common.glsl
+struct GpuWorldParams {
+  uint32_t seed;
+  std::array<uint32_t, kMaterialSlots> fluidity;
+};
+static_assert(sizeof(GpuWorldParams) == 17 * sizeof(uint32_t),
+              "GpuWorldParams must match the std430 layout");
+
+GpuWorldParams ToGpu(const RuleParams& params) {
+  GpuWorldParams gpu_params{.seed = params.seed, .fluidity = {}};
+  std::ranges::copy(params.fluidity, gpu_params.fluidity.begin());
+  return gpu_params;
+}
+
+}  // namespace
+
+struct BatchSimImpl {
+  explicit BatchSimImpl(const BatchSimCreateInfo& create_info)
+      : dims(create_info.dims),
+        num_worlds(create_info.num_worlds),
+        work_group_size(create_info.work_group_size),
+        backend(create_info.backend),
+        rules(create_info.rules),
+        cell_format(create_info.cell_format),
+        num_chunks(NumChunks(create_info.dims)),
+        chunks_per_world(num_chunks.x * num_chunks.y),
+        num_threads(create_info.num_threads ? create_info.num_threads
+                                            : std::thread::hardware_concurrency()) {}
+  glm::ivec2 dims;
+  int num_worlds;
+  glm::ivec2 work_group_size;
+  SimBackend backend;
+  SimRules rules;
+  CellFormat cell_format;
+  glm::ivec2 num_chunks;
+  int chunks_per_world;
+  uint32_t num_threads;
+  uint64_t tick{0};
+  // in any world, each tagged with its world
+  std::vector<Modification> modifications;
+
+  // CPU backend: one CpuSim per world with the modifications of each, stepped on pool
+  std::vector<std::unique_ptr<CpuSim>> cpu_sims;
+  std::vector<std::vector<Modification>> world_modifications;
+  std::unique_ptr<ThreadPool> pool;
+
+  // GPU backend: one texture array layer per world, the chunks of world w start at
+  // w * chunks_per_world in every buffer indexed by chunk
+  gl::Texture curr_tex;
+  gl::Texture prev_tex;
+  gl::Buffer chunk_buffer;
+  // indirect dispatch args followed by the indices of awake chunks of every world
+  gl::Buffer active_chunk_buffer;
+  // GpuWorldParams per world
+  gl::Buffer world_params_buffer;
+  gl::RingBuffer upload_ring;
+  uint32_t params_stride{0};
+  uint32_t storage_alignment{1};
+  ModificationBins mod_bins;
+  gl::DefineSet kernel_defines;
+  std::optional<gl::Shader> compact_shader;
+  std::optional<gl::Shader> sim_shader;
+  uint64_t kernels_generation{0};
+
+  [[nodiscard]] GLenum GlCellFormat() const {
+    return cell_format == CellFormat::kR8ui ? GL_R8UI : GL_R32UI;
+  }
+
+  [[nodiscard]] int NumPasses() const {
+    return rules == SimRules::kMargolus ? kMargolusPasses : 1;
+  }
+
+  // Like SandSimImpl::ResolveKernels, keeps the previous kernels if a permutation fails to
+  // compile. Returns false if there are none yet, the batch can't step until the shader is fixed.
+  bool ResolveKernels() {
+    gl::ShaderManager& manager = gl::ShaderManager::Get();
+    if (sim_shader.has_value() && kernels_generation == manager.Generation()) return true;
+    std::optional<gl::Shader> compact = manager.GetShader("chunk_compact");
+    std::optional<gl::Shader> sim =
+        manager.GetShader(rules == SimRules::kMargolus ? "margolus" : "demo", kernel_defines);
+    if (!compact.has_value() || !sim.has_value()) {
+      spdlog::error("Batch kernels failed to compile{}",
+                    sim_shader.has_value() ? ", keeping the previous ones" : "");
+      return sim_shader.has_value();
+    }
+    compact_shader.emplace(*compact);
+    sim_shader.emplace(*sim);
+    kernels_generation = manager.Generation();
+    return true;
+  }
+
+  void StartGpu() {
+    AddSimKernels();
+    kernel_defines = gl::DefineSet({{"WORK_GROUP_X", std::to_string(work_group_size.x)},
+                                    {"WORK_GROUP_Y", std::to_string(work_group_size.y)},
+                                    {"CELL_FORMAT", cell_format == CellFormat::kR8ui ? "r8ui"
+                                                                                     : "r32ui"},
+                                    {"BATCHED", "1"}});
+    GLint params_alignment = 1;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &params_alignment);
+    params_stride =
+        (sizeof(SimParams) + params_alignment - 1) / params_alignment * params_alignment;
+    GLint alignment = 1;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    storage_alignment = alignment;
+    upload_ring.Init(64 * 1024);
+
+    // the awake chunks of every world share one indirect dispatch
+    uint32_t total_chunks = chunks_per_world * num_worlds;
+    GLint max_groups = 0;
+    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &max_groups);
+    EASSERT_MSG(total_chunks <= static_cast<uint32_t>(max_groups),
+                "Too many chunks in the batch for one dispatch");
+    std::vector<GpuChunk> chunks;
+    chunks.reserve(total_chunks);
+    std::vector<GpuChunk> world_chunks = AwakeGpuChunks(dims, rules);
+    for (int world = 0; world < num_worlds; world++) {
+      chunks.insert(chunks.end(), world_chunks.begin(), world_chunks.end());
+    }
+    chunk_buffer.Init(sizeof(GpuChunk) * total_chunks, GL_DYNAMIC_STORAGE_BIT, chunks.data());
+    glm::ivec2 groups_per_chunk = GroupsPerChunk(rules, work_group_size);
+    std::vector<uint32_t> active_chunk_data(3 + total_chunks, 0);
+    active_chunk_data[1] = groups_per_chunk.x * groups_per_chunk.y;
+    active_chunk_data[2] = 1;
+    active_chunk_buffer.Init(sizeof(uint32_t) * active_chunk_data.size(), GL_DYNAMIC_STORAGE_BIT,
+                             active_chunk_data.data());
+    std::vector<GpuWorldParams> world_params(num_worlds, ToGpu(RuleParams{}));
+    world_params_buffer.Init(sizeof(GpuWorldParams) * num_worlds, GL_DYNAMIC_STORAGE_BIT,
+                             world_params.data());
+
+    gl::Tex2DCreateInfoEmpty params{.dims = dims,
+                                    .wrap_s = GL_CLAMP_TO_EDGE,
+                                    .wrap_t = GL_CLAMP_TO_EDGE,
+                                    .internal_format = GlCellFormat(),
+                                    .min_filter = GL_NEAREST,
+                                    .mag_filter = GL_NEAREST,
+                                    .layers = num_worlds};
+    curr_tex.Load(params);
+    prev_tex.Load(params);
+    // fresh textures are undefined, the worlds start empty
+    uint32_t empty = CellData::Pack(MaterialType::kNone, 0);
+    for (const gl::Texture* tex : {&prev_tex, &curr_tex}) {
+      glClearTexImage(tex->Id(), 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &empty);
+    }
+  }
+
+  // Uploads the modifications of every world, their bins and the SimParams of every pass, like
+  // SandSimImpl::UploadBatch. Returns the offset of the first pass's params.
+  uint32_t UploadBatch(uint32_t num_ticks) {
+    std::span<const Modification> batch = modifications;
+    size_t bins_bytes = 0;
+    if (!batch.empty()) {
+      mod_bins.Build(batch, dims, rules == SimRules::kMargolus ? 1 : 0, num_worlds);
+      bins_bytes = mod_bins.data.size() * sizeof(uint32_t);
+    }
+    int num_passes = NumPasses();
+    size_t params_bytes = static_cast<size_t>(num_ticks) * num_passes * params_stride;
+    size_t bytes =
+        batch.size_bytes() + bins_bytes + params_bytes + 2 * storage_alignment + params_stride;
+    if (bytes > upload_ring.RegionSize()) {
+      size_t region_size = std::max<size_t>(bytes, 2 * upload_ring.RegionSize());
+      upload_ring.Init(static_cast<uint32_t>(region_size));
+    }
+    upload_ring.BeginRegion();
+
+    if (!batch.empty()) {
+      auto mods_size = static_cast<uint32_t>(batch.size_bytes());
+      uint32_t mods_offset = upload_ring.Allocate(mods_size, storage_alignment).value();
+      std::memcpy(upload_ring.Data(mods_offset), batch.data(), mods_size);
+      upload_ring.GetBuffer().BindRange(GL_SHADER_STORAGE_BUFFER, 0, mods_offset, mods_size);
+      auto bins_size = static_cast<uint32_t>(bins_bytes);
+      uint32_t bins_offset = upload_ring.Allocate(bins_size, storage_alignment).value();
+      std::memcpy(upload_ring.Data(bins_offset), mod_bins.data.data(), bins_size);
+      upload_ring.GetBuffer().BindRange(GL_SHADER_STORAGE_BUFFER, 3, bins_offset, bins_size);
+    }
+
+    glm::ivec2 groups_per_chunk = GroupsPerChunk(rules, work_group_size);
+    uint32_t params_offset =
+        upload_ring.Allocate(static_cast<uint32_t>(params_bytes), params_stride).value();
+    std::byte* params_data = upload_ring.Data(params_offset);
+    for (uint32_t i = 0; i < num_ticks; i++) {
+      for (int pass = 0; pass < num_passes; pass++) {
+        uint64_t pass_tick = tick + i;
+        SimParams params{
+            .grid_size_x = dims.x,
+            .grid_size_y = dims.y,
+            .num_chunks_x = num_chunks.x,
+            .num_chunks_y = num_chunks.y,
+            .groups_per_chunk_x = groups_per_chunk.x,
+            .modification_count = i == 0 && pass == 0 ? static_cast<int>(batch.size()) : 0,
+            .block_offset = rules == SimRules::kMargolus ? pass : -1,
+            // each world mixes in its own seed, see PassSeed
+            .seed = static_cast<uint32_t>(pass_tick * kMargolusPasses + pass),
+            .tick = static_cast<uint32_t>(pass_tick),
+            .num_worlds = num_worlds,
+        };
+        std::memcpy(params_data, &params, sizeof(params));
+        params_data += params_stride;
+      }
+    }
+    return params_offset;
+  }
+
+  // Returns false without stepping if there are no kernels to step with.
+  bool SimulateGpu(uint32_t num_ticks) {
+    if (!ResolveKernels()) return false;
+    uint32_t params_offset = UploadBatch(num_ticks);
+    modifications.clear();
+    chunk_buffer.BindBase(GL_SHADER_STORAGE_BUFFER, 1);
+    active_chunk_buffer.BindBase(GL_SHADER_STORAGE_BUFFER, 2);
+    active_chunk_buffer.Bind(GL_DISPATCH_INDIRECT_BUFFER);
+    world_params_buffer.BindBase(GL_SHADER_STORAGE_BUFFER, 5);
+
+    // Same passes as SandSim::SimulateTicks, each covering every world at once. The compaction
+    // gathers the awake chunks of all worlds into one list, so one indirect dispatch advances
+    // them all and sleeping worlds cost nothing.
+    int total_chunks = chunks_per_world * num_worlds;
+    for (uint32_t i = 0; i < num_ticks; i++) {
+      for (int pass = 0; pass < NumPasses(); pass++) {
+        upload_ring.GetBuffer().BindRange(GL_UNIFORM_BUFFER, 0, params_offset, sizeof(SimParams));
+        params_offset += params_stride;
+        uint32_t zero = 0;
+        glClearNamedBufferSubData(active_chunk_buffer.Id(), GL_R32UI, 0, sizeof(uint32_t),
+                                  GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+        compact_shader->Bind();
+        glDispatchCompute((total_chunks + kCompactGroupSize - 1) / kCompactGroupSize, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+        sim_shader->Bind();
+        // layered, so the kernels see every world
+        glBindImageTexture(0, prev_tex.Id(), 0, GL_TRUE, 0, GL_READ_ONLY, GlCellFormat());
+        glBindImageTexture(1, curr_tex.Id(), 0, GL_TRUE, 0, GL_WRITE_ONLY, GlCellFormat());
+        glDispatchComputeIndirect(0);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT |
+                        GL_BUFFER_UPDATE_BARRIER_BIT);
+        std::swap(curr_tex, prev_tex);
+      }
+    }
+    upload_ring.EndRegion();
+    return true;
+  }
+
+  void SimulateCpu(uint32_t num_ticks) {
+    for (Modification& mod : modifications) {
+      int world = std::exchange(mod.world, 0);
+      world_modifications[world].emplace_back(mod);
+    }
+    modifications.clear();
+    // each world is single threaded, the worlds are the parallel work
+    pool->ParallelFor(num_worlds, [&](uint32_t world) {
+      CpuSim& sim = *cpu_sims[world];
+      sim.Step(world_modifications[world], tick);
+      for (uint32_t i = 1; i < num_ticks; i++) sim.Step({}, tick + i);
+      world_modifications[world].clear();
+    });
+  }
+};
+
+BatchSim::BatchSim() = default;
+
+BatchSim::~BatchSim() = default;
+
+void BatchSim::Start(const BatchSimCreateInfo& create_info) {
+  EASSERT_MSG(create_info.num_worlds > 0, "A batch needs at least one world");
+  impl_ = std::make_unique<BatchSimImpl>(create_info);
+  if (impl_->backend == SimBackend::kGpu) {
+    impl_->StartGpu();
+    return;
+  }
+  impl_->pool = std::make_unique<ThreadPool>(impl_->num_threads);
+  impl_->world_modifications.resize(create_info.num_worlds);
+  for (int world = 0; world < create_info.num_worlds; world++) {
+    impl_->cpu_sims.emplace_back(std::make_unique<CpuSim>(create_info.dims, 1,
+                                                          create_info.cpu_kernel,
+                                                          create_info.rules));
+  }
+}
+
+void BatchSim::Simulate(uint32_t num_ticks) {
+  if (num_ticks == 0) return;
+  if (impl_->backend == SimBackend::kGpu) {
+    if (!impl_->SimulateGpu(num_ticks)) return;
+  } else {
+    impl_->SimulateCpu(num_ticks);
+  }
+  impl_->tick += num_ticks;
+}
+
+void BatchSim::SetGrid(int world, std::span<const uint32_t> grid) {
+  EASSERT_MSG(world >= 0 && world < impl_->num_worlds, "World out of range");
+  const glm::ivec2& dims = impl_->dims;
+  EASSERT_MSG(grid.size() == static_cast<size_t>(dims.x) * dims.y, "Grid size mismatch");
+  if (impl_->backend == SimBackend::kCpu) {
+    impl_->cpu_sims[world]->SetGrid(grid);
+    return;
+  }
+  // GL narrows the uint32_t cells itself when the textures are R8UI
+  for (const gl::Texture* tex : {&impl_->prev_tex, &impl_->curr_tex}) {
+    glTextureSubImage3D(tex->Id(), 0, 0, 0, world, dims.x, dims.y, 1, GL_RED_INTEGER,
+                        GL_UNSIGNED_INT, grid.data());
+  }
+  std::vector<GpuChunk> chunks = AwakeGpuChunks(dims, impl_->rules);
+  glNamedBufferSubData(impl_->chunk_buffer.Id(),
+                       static_cast<GLintptr>(sizeof(GpuChunk)) * impl_->chunks_per_world * world,
+                       chunks.size() * sizeof(GpuChunk), chunks.data());
+}
+
+void BatchSim::SetRuleParams(int world, const RuleParams& params) {
+  EASSERT_MSG(world >= 0 && world < impl_->num_worlds, "World out of range");
+  if (impl_->backend == SimBackend::kCpu) {
+    impl_->cpu_sims[world]->SetRuleParams(params);
+    return;
+  }
+  GpuWorldParams gpu_params = ToGpu(params);
+  glNamedBufferSubData(impl_->world_params_buffer.Id(),
+                       static_cast<GLintptr>(sizeof(GpuWorldParams)) * world, sizeof(gpu_params),
+                       &gpu_params);
+}
+
+void BatchSim::AddModification(const Modification& modification) {
+  EASSERT_MSG(modification.world >= 0 && modification.world < impl_->num_worlds,
+              "Modification world out of range");
+  impl_->modifications.emplace_back(modification);
+}
+
+std::vector<uint32_t> BatchSim::GetGrid(int world) const {
+  EASSERT_MSG(world >= 0 && world < impl_->num_worlds, "World out of range");
+  if (impl_->backend == SimBackend::kCpu) return impl_->cpu_sims[world]->GetGrid();
+  const glm::ivec2& dims = impl_->dims;
+  std::vector<uint32_t> grid(static_cast<size_t>(dims.x) * dims.y);
+  // the GPU path swaps after dispatching, so the latest output is in prev_tex
+  glGetTextureSubImage(impl_->prev_tex.Id(), 0, 0, 0, world, dims.x, dims.y, 1, GL_RED_INTEGER,
+                       GL_UNSIGNED_INT, static_cast<GLsizei>(grid.size() * sizeof(uint32_t)),
+                       grid.data());
+  return grid;
+}
+
+int BatchSim::NumWorlds() const { return impl_->num_worlds; }
+
+glm::ivec2 BatchSim::GetDims() const { return impl_->dims; }
+
+uint64_t BatchSim::GetTick() const { return impl_->tick; }
+
+}  // namespace sand
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <span>
+
+#include "sand_sim/Rules.hpp"
+#include "sand_sim/SandSim.hpp"
+
+namespace sand {
+
+struct BatchSimImpl;
+struct Modification;
+
+struct BatchSimCreateInfo {
+  glm::ivec2 dims;
+  int num_worlds{1};
+  glm::ivec2 work_group_size{8, 8};
+  SimBackend backend{SimBackend::kGpu};
+  SimRules rules{SimRules::kMargolus};
+  CellFormat cell_format{CellFormat::kR8ui};
+  CpuKernel cpu_kernel{CpuKernel::kBitPlane};
+  // 0 uses one thread per hardware thread
+  uint32_t num_threads{0};
+};
+
+// Many independent worlds of the same size simulated in lockstep, for sweeping rule parameters
+// over lots of small boards. Always headless. On the GPU the worlds are the layers of texture
+// arrays and each pass is one compaction and one indirect dispatch over the awake chunks of
+// every world, so the dispatch count doesn't grow with the number of worlds. On the CPU each
+// world is its own single threaded CpuSim and the worlds are stepped in parallel.
+class BatchSim {
+ public:
+  BatchSim();
+  // default for pimpl
+  ~BatchSim();
+  // Every world starts empty with the default rule parameters.
+  void Start(const BatchSimCreateInfo& create_info);
+  // Runs num_ticks ticks of every world.
+  void Simulate(uint32_t num_ticks = 1);
+  // Replaces the grid of one world and wakes its chunks.
+  void SetGrid(int world, std::span<const uint32_t> grid);
+  // Takes effect on the next Simulate(). Only the Margolus rules have parameters.
+  void SetRuleParams(int world, const RuleParams& params);
+  // Queues an edit of modification.world for the next Simulate().
+  void AddModification(const Modification& modification);
+  // Reads back the most recently simulated grid of one world, row major with y = 0 at the
+  // bottom.
+  [[nodiscard]] std::vector<uint32_t> GetGrid(int world) const;
+  [[nodiscard]] int NumWorlds() const;
+  [[nodiscard]] glm::ivec2 GetDims() const;
+  [[nodiscard]] uint64_t GetTick() const;
+
+ private:
+  std::unique_ptr<BatchSimImpl> impl_;
+};
+
+}  // namespace sand
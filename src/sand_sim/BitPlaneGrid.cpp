@@ -0,0 +1,308 @@
+#include "BitPlaneGrid.hpp"
+
+#include <array>
+#include <bit>
+#include <cstdlib>
+
+#include "sand_sim/Rules.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SAND_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(SAND_X86) && defined(__GNUC__)
+// lets the AVX2 path live next to the fallback without building the whole file for AVX2
+#define SAND_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define SAND_TARGET_AVX2
+#endif
+
+namespace sand {
+
+namespace {
+
+constexpr int kPlanes = BitPlaneGrid::kPlanes;
+
+// The word-parallel rules below hard-code how sand and empty cells interact. Anything else goes
+// through SimulateCell.
+using SandTraits = MaterialTraits<MaterialType::kSand>;
+using NoneTraits = MaterialTraits<MaterialType::kNone>;
+static_assert(SandTraits::kGravity == Gravity::kDown && NoneTraits::kGravity != Gravity::kUp &&
+                  SandTraits::kDensity > NoneTraits::kDensity,
+              "Sand must sink into empty cells");
+
+// The rows just outside a chunk, per plane.
+struct EdgeRows {
+  // row 0 of the chunk above, empty at the top of the grid
+  std::array<uint64_t, kPlanes> above{};
+  // last row of the chunk below, solid at the bottom of the grid so nothing falls out
+  std::array<uint64_t, kPlanes> below{};
+};
+
+// Transposes the 8x8 bit matrix with row r in byte r, so bit c of byte r moves to bit r of
+// byte c. Turns one byte from each of the 8 planes into the 8 cell bytes. From Hacker's Delight.
+uint64_t Transpose8x8(uint64_t x) {
+  uint64_t t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaull;
+  x = x ^ t ^ (t << 7);
+  t = (x ^ (x >> 14)) & 0x0000cccc0000ccccull;
+  x = x ^ t ^ (t << 14);
+  t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ull;
+  return x ^ t ^ (t << 28);
+}
+
+// bits first through last, inclusive
+uint64_t BitRange(int first, int last) { return (~0ull >> (63 - last)) & (~0ull << first); }
+
+// Applies the rules of simulate() in demo.cs.glsl to row r of a chunk block for the cells in
+// mask. Returns the cells that changed.
+uint64_t SimulateRow(const uint64_t* in, uint64_t* out, int r, uint64_t mask,
+                     const EdgeRows& edges) {
+  std::array<uint64_t, kPlanes> self, above, below;
+  for (int b = 0; b < kPlanes; b++) {
+    const uint64_t* plane = in + b * kChunkSize;
+    self[b] = plane[r];
+    above[b] = r + 1 < kChunkSize ? plane[r + 1] : edges.above[b];
+    below[b] = r > 0 ? plane[r - 1] : edges.below[b];
+  }
+  // the material is the low 4 bits of the cell
+  uint64_t self_any = self[0] | self[1] | self[2] | self[3];
+  uint64_t above_sand = above[0] & ~(above[1] | above[2] | above[3]);
+  uint64_t below_any = below[0] | below[1] | below[2] | below[3];
+  uint64_t fall_in = above_sand & ~self_any & mask;
+  uint64_t fall_out = ~below_any & self_any & mask;
+  uint64_t keep = ~(fall_in | fall_out);
+  uint64_t changed = 0;
+  for (int b = 0; b < kPlanes; b++) {
+    uint64_t value = (fall_in & above[b]) | (fall_out & below[b]) | (keep & self[b]);
+    out[b * kChunkSize + r] = value;
+    changed |= value ^ self[b];
+  }
+  return changed;
+}
+
+#ifdef SAND_X86
+// SimulateRow for four rows at once, rows first_row to last_row of the chunk.
+SAND_TARGET_AVX2 void SimulateRowsAvx2(const uint64_t* in, uint64_t* out, int first_row,
+                                       int last_row, uint64_t x_mask, const EdgeRows& edges,
+                                       uint64_t* changed) {
+  auto row_mask = [&](int r) {
+    return static_cast<long long>(r >= first_row && r <= last_row ? x_mask : 0);
+  };
+  for (int r = first_row & ~3; r <= last_row; r += 4) {
+    __m256i mask = _mm256_set_epi64x(row_mask(r + 3), row_mask(r + 2), row_mask(r + 1),
+                                     row_mask(r));
+    __m256i self[kPlanes], above[kPlanes], below[kPlanes];
+    for (int b = 0; b < kPlanes; b++) {
+      const auto* plane = reinterpret_cast<const long long*>(in + b * kChunkSize);
+      self[b] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(plane + r));
+      above[b] = r + 4 < kChunkSize
+                     ? _mm256_loadu_si256(reinterpret_cast<const __m256i*>(plane + r + 1))
+                     : _mm256_set_epi64x(static_cast<long long>(edges.above[b]), plane[r + 3],
+                                         plane[r + 2], plane[r + 1]);
+      below[b] = r > 0 ? _mm256_loadu_si256(reinterpret_cast<const __m256i*>(plane + r - 1))
+                       : _mm256_set_epi64x(plane[r + 2], plane[r + 1], plane[r],
+                                           static_cast<long long>(edges.below[b]));
+    }
+    __m256i self_any = _mm256_or_si256(_mm256_or_si256(self[0], self[1]),
+                                       _mm256_or_si256(self[2], self[3]));
+    __m256i above_upper = _mm256_or_si256(_mm256_or_si256(above[1], above[2]), above[3]);
+    __m256i below_any = _mm256_or_si256(_mm256_or_si256(below[0], below[1]),
+                                        _mm256_or_si256(below[2], below[3]));
+    // _mm256_andnot_si256(a, b) is ~a & b
+    __m256i fall_in = _mm256_and_si256(
+        _mm256_andnot_si256(self_any, _mm256_andnot_si256(above_upper, above[0])), mask);
+    __m256i fall_out = _mm256_and_si256(_mm256_andnot_si256(below_any, self_any), mask);
+    __m256i keep =
+        _mm256_andnot_si256(_mm256_or_si256(fall_in, fall_out), _mm256_set1_epi64x(-1));
+    __m256i diff = _mm256_setzero_si256();
+    for (int b = 0; b < kPlanes; b++) {
+      __m256i moved = _mm256_or_si256(_mm256_and_si256(fall_in, above[b]),
+                                      _mm256_and_si256(fall_out, below[b]));
+      __m256i value = _mm256_or_si256(moved, _mm256_and_si256(keep, self[b]));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + b * kChunkSize + r), value);
+      diff = _mm256_or_si256(diff, _mm256_xor_si256(value, self[b]));
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(changed + r), diff);
+  }
+}
+#endif
+
+bool DetectAvx2() {
+  // lets the fallback be checked against the AVX2 path on the same machine
+  if (std::getenv("SAND_DISABLE_AVX2")) return false;
+#if defined(SAND_X86) && defined(__GNUC__)
+  return __builtin_cpu_supports("avx2");
+#elif defined(SAND_X86) && defined(_MSC_VER)
+  int info[4];
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  return false;
+#endif
+}
+
+}  // namespace
+
+BitPlaneGrid::BitPlaneGrid(const glm::ivec2& dims)
+    : dims_(dims),
+      num_chunks_(NumChunks(dims)),
+      words_(static_cast<size_t>(num_chunks_.x) * num_chunks_.y * kPlanes * kChunkSize, 0) {}
+
+void BitPlaneGrid::Set(std::span<const uint32_t> grid) {
+  EASSERT_MSG(grid.size() == static_cast<size_t>(dims_.x) * dims_.y, "Grid size mismatch");
+  std::fill(words_.begin(), words_.end(), 0);
+  for (int y = 0; y < dims_.y; y++) {
+    for (int x = 0; x < dims_.x; x++) {
+      uint32_t cell = grid[static_cast<size_t>(y) * dims_.x + x];
+      if (cell != 0) SetCell(x, y, cell);
+    }
+  }
+}
+
+void BitPlaneGrid::Unpack(const DirtyRect& rect, std::vector<uint32_t>& grid) const {
+  for (int y = rect.min.y; y <= rect.max.y; y++) {
+    uint32_t* row = grid.data() + static_cast<size_t>(y) * dims_.x;
+    // one chunk at a time, eight cells per step
+    for (int x = rect.min.x; x <= rect.max.x;) {
+      int chunk_x = x / kChunkSize;
+      const uint64_t* chunk = Chunk((y / kChunkSize) * num_chunks_.x + chunk_x) + y % kChunkSize;
+      int end = std::min(rect.max.x, (chunk_x + 1) * kChunkSize - 1);
+      for (int group = x % kChunkSize / 8; chunk_x * kChunkSize + group * 8 <= end; group++) {
+        uint64_t cells = 0;
+        for (int b = 0; b < kPlanes; b++) {
+          cells |= ((chunk[b * kChunkSize] >> (group * 8)) & 0xff) << (b * 8);
+        }
+        cells = Transpose8x8(cells);
+        int first = chunk_x * kChunkSize + group * 8;
+        for (int i = std::max(x, first); i <= std::min(end, first + 7); i++) {
+          row[i] = static_cast<uint32_t>(cells >> ((i - first) * 8)) & 0xff;
+        }
+      }
+      x = end + 1;
+    }
+  }
+}
+
+uint32_t BitPlaneGrid::GetCell(int x, int y) const {
+  const uint64_t* chunk =
+      Chunk((y / kChunkSize) * num_chunks_.x + x / kChunkSize) + y % kChunkSize;
+  uint32_t cell = 0;
+  for (int b = 0; b < kPlanes; b++) {
+    cell |= static_cast<uint32_t>((chunk[b * kChunkSize] >> (x % kChunkSize)) & 1) << b;
+  }
+  return cell;
+}
+
+void BitPlaneGrid::SetCell(int x, int y, uint32_t cell) {
+  uint64_t* chunk = Chunk((y / kChunkSize) * num_chunks_.x + x / kChunkSize) + y % kChunkSize;
+  uint64_t bit = 1ull << (x % kChunkSize);
+  for (int b = 0; b < kPlanes; b++) {
+    if ((cell >> b) & 1) {
+      chunk[b * kChunkSize] |= bit;
+    } else {
+      chunk[b * kChunkSize] &= ~bit;
+    }
+  }
+}
+
+DirtyRect SimulateChunkBitPlanes(const BitPlaneGrid& in, BitPlaneGrid& out,
+                                 const glm::ivec2& dims, uint32_t chunk_index,
+                                 const DirtyRect& rect, std::span<const uint32_t> bin,
+                                 std::span<const Modification> modifications) {
+  glm::ivec2 num_chunks = NumChunks(dims);
+  auto index = static_cast<int>(chunk_index);
+  glm::ivec2 origin = glm::ivec2{index % num_chunks.x, index / num_chunks.x} * kChunkSize;
+  EdgeRows edges;
+  if (origin.y + kChunkSize < dims.y) {
+    const uint64_t* above = in.Chunk(chunk_index + num_chunks.x);
+    for (int b = 0; b < kPlanes; b++) edges.above[b] = above[b * kChunkSize];
+  }
+  if (origin.y > 0) {
+    const uint64_t* below = in.Chunk(chunk_index - num_chunks.x);
+    for (int b = 0; b < kPlanes; b++) edges.below[b] = below[b * kChunkSize + kChunkSize - 1];
+  } else {
+    // material 15 in every bit, which is never empty
+    for (int b = 0; b < 4; b++) edges.below[b] = ~0ull;
+  }
+
+  const uint64_t* src = in.Chunk(chunk_index);
+  uint64_t* dst = out.Chunk(chunk_index);
+  int first_row = rect.min.y - origin.y;
+  int last_row = rect.max.y - origin.y;
+  uint64_t x_mask = BitRange(rect.min.x - origin.x, rect.max.x - origin.x);
+  // Planes 1 to 3 are only set for materials past sand. Rows the rules read that hold any fall
+  // back to SimulateCell, one cell at a time.
+  uint64_t other_materials = 0;
+  for (int r = first_row - kReachBelow; r <= last_row + kReachAbove; r++) {
+    int y = origin.y + r;
+    if (y < 0 || y >= dims.y) continue;
+    const uint64_t* chunk = r < 0            ? in.Chunk(chunk_index - num_chunks.x) + kChunkSize
+                            : r >= kChunkSize ? in.Chunk(chunk_index + num_chunks.x) - kChunkSize
+                                              : src;
+    for (int b = 1; b < 4; b++) other_materials |= chunk[b * kChunkSize + r];
+  }
+
+  std::array<uint64_t, kChunkSize> changed{};
+  if (other_materials & x_mask) {
+    auto get = [&](int x, int y) { return in.GetCell(x, y); };
+    for (int y = rect.min.y; y <= rect.max.y; y++) {
+      for (int x = rect.min.x; x <= rect.max.x; x++) {
+        uint32_t result = SimulateCell(get, x, y, dims);
+        out.SetCell(x, y, result);
+        if (result != in.GetCell(x, y)) changed[y - origin.y] |= 1ull << (x - origin.x);
+      }
+    }
+  } else if (BitPlanesUseAvx2()) {
+#ifdef SAND_X86
+    SimulateRowsAvx2(src, dst, first_row, last_row, x_mask, edges, changed.data());
+#endif
+  } else {
+    for (int r = first_row; r <= last_row; r++) {
+      changed[r] = SimulateRow(src, dst, r, x_mask, edges);
+    }
+  }
+
+  if (!bin.empty()) {
+    // the first matching modification wins, so write them back to front
+    for (auto it = bin.rbegin(); it != bin.rend(); it++) {
+      const Modification& mod = modifications[*it];
+      DirtyRect bounds = ModificationBounds(mod).Intersect(rect);
+      for (int y = bounds.min.y; y <= bounds.max.y; y++) {
+        for (int x = bounds.min.x; x <= bounds.max.x; x++) {
+          if (IsInsideModification(x, y, mod)) out.SetCell(x, y, static_cast<uint32_t>(mod.cell));
+        }
+      }
+    }
+    for (int r = first_row; r <= last_row; r++) {
+      changed[r] = 0;
+      for (int b = 0; b < kPlanes; b++) {
+        changed[r] |= dst[b * kChunkSize + r] ^ src[b * kChunkSize + r];
+      }
+    }
+  }
+
+  DirtyRect result;
+  uint64_t columns = 0;
+  for (int r = first_row; r <= last_row; r++) {
+    if (!changed[r]) continue;
+    columns |= changed[r];
+    result.min.y = std::min(result.min.y, origin.y + r);
+    result.max.y = origin.y + r;
+  }
+  if (columns) {
+    result.min.x = origin.x + std::countr_zero(columns);
+    result.max.x = origin.x + 63 - std::countl_zero(columns);
+  }
+  return result;
+}
+
+bool BitPlanesUseAvx2() {
+  static const bool use_avx2 = DetectAvx2();
+  return use_avx2;
+}
+
+}  // namespace sand
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <span>
+
+#include "sand_sim/Cell.hpp"
+#include "sand_sim/Chunk.hpp"
+
+namespace sand {
+
+static_assert(kChunkSize == 64, "BitPlaneGrid stores one chunk row per 64-bit word");
+
+// Cells stored as the 8 bit-planes of their CellData byte. Each chunk owns a contiguous block of
+// kPlanes x kChunkSize words, one word per chunk row, so the sand and empty rules of
+// demo.cs.glsl become bitwise ops on 64 cells at once. Chunks near other materials take the
+// generic rules per cell instead. Cells outside the grid are kept empty.
+class BitPlaneGrid {
+ public:
+  static constexpr int kPlanes = 8;
+
+  explicit BitPlaneGrid(const glm::ivec2& dims);
+  void Set(std::span<const uint32_t> grid);
+  // Writes the cells of rect into grid, one uint32_t per cell.
+  void Unpack(const DirtyRect& rect, std::vector<uint32_t>& grid) const;
+  [[nodiscard]] uint32_t GetCell(int x, int y) const;
+  void SetCell(int x, int y, uint32_t cell);
+
+  [[nodiscard]] uint64_t* Chunk(uint32_t chunk_index) {
+    return words_.data() + static_cast<size_t>(chunk_index) * kPlanes * kChunkSize;
+  }
+  [[nodiscard]] const uint64_t* Chunk(uint32_t chunk_index) const {
+    return words_.data() + static_cast<size_t>(chunk_index) * kPlanes * kChunkSize;
+  }
+
+ private:
+  glm::ivec2 dims_;
+  glm::ivec2 num_chunks_;
+  std::vector<uint64_t> words_;
+};
+
+// Simulates the cells of rect, which must lie inside chunk_index, reading in and writing out.
+// Modifications are applied from bin like the scalar path. Returns the cells that changed. The
+// output matches the scalar CPU kernel bit for bit.
+DirtyRect SimulateChunkBitPlanes(const BitPlaneGrid& in, BitPlaneGrid& out,
+                                 const glm::ivec2& dims, uint32_t chunk_index,
+                                 const DirtyRect& rect, std::span<const uint32_t> bin,
+                                 std::span<const Modification> modifications);
+
+// Whether SimulateChunkBitPlanes runs 256 cells at a time with AVX2 on this CPU, decided once at
+// startup. Otherwise it falls back to 64-bit words.
+bool BitPlanesUseAvx2();
+
+}  // namespace sand
@@ -0,0 +1,32 @@
+#pragma once
+
+namespace sand {
+
+// Index into kMaterials in Material.hpp, which defines how each material behaves.
+enum class MaterialType : uint8_t { kNone = 0, kSand = 1, kWater = 2 };
+
+struct CellData {
+  MaterialType material_type : 4;
+  uint8_t color_index : 4;
+  [[nodiscard]] uint32_t Pack() const { return Pack(material_type, color_index); }
+  static uint32_t Pack(MaterialType material_type, uint8_t color_index) {
+    return static_cast<uint8_t>(material_type) | color_index << 4;
+    // return static_cast<uint8_t>(material_type) << 4 | color_index;
+  }
+};
+
+enum class ModificationShape : uint32_t { kCircle, kSquare };
+
+// Mirrors the std430 Modification struct in sim_common.glsl. The ivec2 member gives the GLSL
+// struct an 8 byte alignment, so the array stride there is 24 bytes.
+struct Modification {
+  int x, y;
+  float radius{10};
+  ModificationShape shape;
+  int cell{1};
+  // world of a BatchSim the modification applies to, 0 everywhere else
+  int world{0};
+};
+static_assert(sizeof(Modification) == 24, "Modification must match the std430 layout");
+
+}  // namespace sand
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cmath>
+#include <limits>
+#include <span>
+
+#include "sand_sim/Cell.hpp"
+
+namespace sand {
+
+// Side length in cells of the square chunks used for sleep tracking. Must match CHUNK_SIZE in the
+// compute shaders, which is passed in as a define.
+constexpr int kChunkSize = 64;
+
+// Inclusive cell bounds. Empty when max < min on either axis. Layout matches the four ints used
+// for rects in sim_common.glsl.
+struct DirtyRect {
+  glm::ivec2 min{std::numeric_limits<int>::max()};
+  glm::ivec2 max{-1};
+
+  [[nodiscard]] bool Empty() const { return max.x < min.x || max.y < min.y; }
+  void Include(int x, int y) {
+    min = glm::min(min, glm::ivec2{x, y});
+    max = glm::max(max, glm::ivec2{x, y});
+  }
+  void Include(const DirtyRect& other) {
+    min = glm::min(min, other.min);
+    max = glm::max(max, other.max);
+  }
+  [[nodiscard]] DirtyRect Intersect(const DirtyRect& other) const {
+    return {glm::max(min, other.min), glm::min(max, other.max)};
+  }
+  [[nodiscard]] DirtyRect Expand(int amount) const {
+    return {min - glm::ivec2{amount}, max + glm::ivec2{amount}};
+  }
+};
+
+inline glm::ivec2 NumChunks(const glm::ivec2& dims) {
+  return (dims + glm::ivec2{kChunkSize - 1}) / glm::ivec2{kChunkSize};
+}
+
+inline DirtyRect GridBounds(const glm::ivec2& dims) { return {{0, 0}, dims - glm::ivec2{1}}; }
+
+inline DirtyRect ChunkBounds(const glm::ivec2& chunk, const glm::ivec2& dims) {
+  DirtyRect bounds{chunk * kChunkSize, chunk * kChunkSize + glm::ivec2{kChunkSize - 1}};
+  return bounds.Intersect(GridBounds(dims));
+}
+
+// Cells a modification can write to. Must match modification_bounds in sim_common.glsl.
+inline DirtyRect ModificationBounds(const Modification& mod) {
+  if (mod.shape != ModificationShape::kCircle || mod.radius <= 0) return {};
+  // is_inside_circle compares the squared distance against radius
+  int extent = static_cast<int>(std::ceil(std::sqrt(mod.radius)));
+  return {{mod.x - extent, mod.y - extent}, {mod.x + extent, mod.y + extent}};
+}
+
+// Whether a modification writes the cell at x, y. Must match update_cell in demo.cs.glsl, where
+// is_inside_circle compares the squared distance against radius.
+inline bool IsInsideModification(int x, int y, const Modification& mod) {
+  if (mod.shape != ModificationShape::kCircle) return false;
+  int dx = x - mod.x;
+  int dy = y - mod.y;
+  return static_cast<float>(dx * dx + dy * dy) < mod.radius;
+}
+
+// Grows the rect of every chunk that rect overlaps by the part of rect inside that chunk.
+inline void MarkChunks(std::vector<DirtyRect>& chunk_rects, const glm::ivec2& dims,
+                       const DirtyRect& rect) {
+  DirtyRect clipped = rect.Intersect(GridBounds(dims));
+  if (clipped.Empty()) return;
+  glm::ivec2 num_chunks = NumChunks(dims);
+  glm::ivec2 first = clipped.min / kChunkSize;
+  glm::ivec2 last = clipped.max / kChunkSize;
+  for (int y = first.y; y <= last.y; y++) {
+    for (int x = first.x; x <= last.x; x++) {
+      chunk_rects[y * num_chunks.x + x].Include(clipped.Intersect(ChunkBounds({x, y}, dims)));
+    }
+  }
+}
+
+// Modifications sorted into the chunks they can write to, so a chunk only tests the brushes that
+// overlap it. Layout matches ModBinBuffer in sim_common.glsl: an (offset, count) pair per chunk,
+// then the modification indices of each bin. Indices keep submission order since the first
+// matching modification wins.
+struct ModificationBins {
+  std::vector<uint32_t> data;
+
+  // margin grows each modification's bounds, so chunks that only own blocks next to it see it.
+  // With num_worlds worlds of dims, the bins of each world follow those of the one before and
+  // every modification lands in the bins of its world.
+  void Build(std::span<const Modification> modifications, const glm::ivec2& dims,
+             int margin = 0, int num_worlds = 1) {
+    glm::ivec2 num_chunks = NumChunks(dims);
+    uint32_t world_count = num_chunks.x * num_chunks.y;
+    uint32_t count = world_count * num_worlds;
+    data.assign(2 * count, 0);
+    auto for_each_chunk = [&](const Modification& mod, auto&& fn) {
+      EASSERT_MSG(mod.world >= 0 && mod.world < num_worlds, "Modification world out of range");
+      DirtyRect bounds = ModificationBounds(mod).Expand(margin).Intersect(GridBounds(dims));
+      if (bounds.Empty()) return;
+      glm::ivec2 first = bounds.min / kChunkSize;
+      glm::ivec2 last = bounds.max / kChunkSize;
+      int base = static_cast<int>(world_count) * mod.world;
+      for (int y = first.y; y <= last.y; y++) {
+        for (int x = first.x; x <= last.x; x++) fn(base + y * num_chunks.x + x);
+      }
+    };
+    for (const Modification& mod : modifications) {
+      for_each_chunk(mod, [&](int chunk) { data[2 * chunk + 1]++; });
+    }
+    uint32_t offset = 2 * count;
+    for (uint32_t i = 0; i < count; i++) {
+      data[2 * i] = offset;
+      offset += data[2 * i + 1];
+      data[2 * i + 1] = 0;
+    }
+    data.resize(offset);
+    for (uint32_t m = 0; m < modifications.size(); m++) {
+      for_each_chunk(modifications[m], [&](int chunk) {
+        data[data[2 * chunk] + data[2 * chunk + 1]++] = m;
+      });
+    }
+  }
+
+  [[nodiscard]] std::span<const uint32_t> Bin(uint32_t chunk_index) const {
+    return {data.data() + data[2 * chunk_index], data[2 * chunk_index + 1]};
+  }
+};
+
+}  // namespace sand
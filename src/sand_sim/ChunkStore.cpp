@@ -0,0 +1,175 @@
+#include "ChunkStore.hpp"
+
+#include <fstream>
+
+namespace sand {
+
+namespace {
+
+constexpr size_t kChunkCells = static_cast<size_t>(kChunkSize) * kChunkSize;
+
+// Settled worlds are mostly long runs of one cell, so run length encoding shrinks them to a
+// few bytes per row without pulling in a compression library.
+std::vector<uint8_t> EncodeCells(const ChunkCells& cells) {
+  std::vector<uint8_t> data;
+  for (size_t i = 0; i < cells.size();) {
+    uint32_t cell = cells[i];
+    EASSERT_MSG(cell <= 0xff, "Cells must fit in a byte");
+    size_t run = 1;
+    while (i + run < cells.size() && cells[i + run] == cell) run++;
+    data.push_back(static_cast<uint8_t>(cell));
+    for (size_t rest = run - 1;; rest >>= 7) {
+      if (rest < 0x80) {
+        data.push_back(static_cast<uint8_t>(rest));
+        break;
+      }
+      data.push_back(static_cast<uint8_t>(rest | 0x80));
+    }
+    i += run;
+  }
+  return data;
+}
+
+// Returns nullopt if data doesn't decode to exactly one chunk.
+std::optional<ChunkCells> DecodeCells(std::span<const uint8_t> data) {
+  ChunkCells cells;
+  cells.reserve(kChunkCells);
+  for (size_t i = 0; i < data.size();) {
+    uint32_t cell = data[i++];
+    size_t rest = 0;
+    for (int shift = 0;; shift += 7) {
+      if (i == data.size() || shift > 28) return std::nullopt;
+      uint8_t byte = data[i++];
+      rest |= static_cast<size_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) break;
+    }
+    if (cells.size() + rest + 1 > kChunkCells) return std::nullopt;
+    cells.insert(cells.end(), rest + 1, cell);
+  }
+  if (cells.size() != kChunkCells) return std::nullopt;
+  return cells;
+}
+
+}  // namespace
+
+ChunkStore::ChunkStore(std::filesystem::path dir) : dir_(std::move(dir)) {
+  std::error_code ec;
+  std::filesystem::create_directories(dir_, ec);
+  if (ec) spdlog::error("Failed to create world directory {}: {}", dir_.string(), ec.message());
+  worker_ = std::thread(&ChunkStore::WorkerLoop, this);
+}
+
+ChunkStore::~ChunkStore() {
+  {
+    std::lock_guard lock(mutex_);
+    stop_ = true;
+  }
+  work_cv_.notify_one();
+  worker_.join();
+}
+
+void ChunkStore::Save(glm::ivec2 pos, ChunkCells cells) {
+  EASSERT_MSG(cells.size() == kChunkCells, "Chunk size mismatch");
+  {
+    std::lock_guard lock(mutex_);
+    jobs_.push_back({.pos = pos, .cells = std::move(cells), .save = true});
+  }
+  work_cv_.notify_one();
+}
+
+void ChunkStore::Load(glm::ivec2 pos) {
+  {
+    std::lock_guard lock(mutex_);
+    jobs_.push_back({.pos = pos, .cells = {}, .save = false});
+  }
+  work_cv_.notify_one();
+}
+
+std::vector<LoadedChunk> ChunkStore::TakeLoaded() {
+  std::lock_guard lock(mutex_);
+  return std::exchange(loaded_, {});
+}
+
+void ChunkStore::WaitIdle() {
+  std::unique_lock lock(mutex_);
+  idle_cv_.wait(lock, [this] { return jobs_.empty() && !busy_; });
+}
+
+void ChunkStore::WorkerLoop() {
+  std::unique_lock lock(mutex_);
+  while (true) {
+    // queued saves are still written when stopping
+    work_cv_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+    if (jobs_.empty()) return;
+    Job job = std::move(jobs_.front());
+    jobs_.pop_front();
+    busy_ = true;
+    lock.unlock();
+    std::optional<LoadedChunk> loaded;
+    if (job.save) {
+      WriteChunk(job.pos, job.cells);
+    } else {
+      loaded = LoadedChunk{.pos = job.pos, .cells = ReadChunk(job.pos)};
+    }
+    lock.lock();
+    if (loaded.has_value()) loaded_.emplace_back(std::move(loaded.value()));
+    busy_ = false;
+    if (jobs_.empty()) idle_cv_.notify_all();
+  }
+}
+
+std::filesystem::path ChunkStore::ChunkPath(glm::ivec2 pos) const {
+  return dir_ / fmt::format("{}_{}.chunk", pos.x, pos.y);
+}
+
+void ChunkStore::WriteChunk(glm::ivec2 pos, const ChunkCells& cells) const {
+  std::vector<uint8_t> data = EncodeCells(cells);
+  ChunkFileHeader header{.magic = kChunkFileMagic,
+                         .version = kChunkFileVersion,
+                         .chunk_size = kChunkSize,
+                         .data_size = static_cast<uint32_t>(data.size())};
+  // written to a temporary first, so a crash never leaves half a chunk behind
+  std::filesystem::path path = ChunkPath(pos);
+  std::filesystem::path tmp_path = path;
+  tmp_path += ".tmp";
+  {
+    std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(data.data()),
+               static_cast<std::streamsize>(data.size()));
+    if (!file) {
+      spdlog::error("Failed to write chunk {}", tmp_path.string());
+      return;
+    }
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmp_path, path, ec);
+  if (ec) spdlog::error("Failed to write chunk {}: {}", path.string(), ec.message());
+}
+
+std::optional<ChunkCells> ChunkStore::ReadChunk(glm::ivec2 pos) const {
+  ChunkCells empty(kChunkCells, 0);
+  std::filesystem::path path = ChunkPath(pos);
+  std::ifstream file(path, std::ios::binary);
+  // never saved
+  if (!file) return std::nullopt;
+  ChunkFileHeader header;
+  file.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!file || header.magic != kChunkFileMagic || header.version != kChunkFileVersion ||
+      header.chunk_size != kChunkSize) {
+    spdlog::error("{} is not a version {} chunk of size {}, treating it as empty", path.string(),
+                  kChunkFileVersion, kChunkSize);
+    return empty;
+  }
+  std::vector<uint8_t> data(header.data_size);
+  file.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size()));
+  std::optional<ChunkCells> cells;
+  if (file) cells = DecodeCells(data);
+  if (!cells.has_value()) {
+    spdlog::error("Chunk {} is truncated or corrupt, treating it as empty", path.string());
+    return empty;
+  }
+  return cells;
+}
+
+}  // namespace sand
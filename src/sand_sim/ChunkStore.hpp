@@ -0,0 +1,81 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+
+#include "sand_sim/Chunk.hpp"
+
+namespace sand {
+
+constexpr uint32_t kChunkFileMagic = 0x4b484353;  // "SCHK"
+constexpr uint32_t kChunkFileVersion = 1;
+
+// Start of every chunk file. data_size bytes of run length encoded cells follow: each run is the
+// cell byte followed by the run length minus one as a LEB128 varint.
+struct ChunkFileHeader {
+  uint32_t magic{kChunkFileMagic};
+  uint32_t version{kChunkFileVersion};
+  int32_t chunk_size{kChunkSize};
+  uint32_t data_size{0};
+};
+static_assert(sizeof(ChunkFileHeader) == 16, "ChunkFileHeader is written to disk as is");
+
+// kChunkSize * kChunkSize CellData::Pack values, row major with y = 0 at the bottom.
+using ChunkCells = std::vector<uint32_t>;
+
+struct LoadedChunk {
+  glm::ivec2 pos;
+  // nullopt if the chunk was never saved, the owner generates those
+  std::optional<ChunkCells> cells;
+};
+
+// Chunks of an unbounded world kept on disk, one compressed file per chunk position. All file
+// I/O runs on a background thread in the order it was queued, so a load queued after a save of
+// the same chunk reads the saved cells.
+class ChunkStore {
+ public:
+  explicit ChunkStore(std::filesystem::path dir);
+  ChunkStore(const ChunkStore& other) = delete;
+  ChunkStore& operator=(const ChunkStore& other) = delete;
+  // Finishes every queued save first.
+  ~ChunkStore();
+
+  // Queues writing cells as the chunk at pos, in chunks.
+  void Save(glm::ivec2 pos, ChunkCells cells);
+  // Queues reading the chunk at pos. It shows up in TakeLoaded once read, without cells if it
+  // was never saved.
+  void Load(glm::ivec2 pos);
+  // Returns the chunks read since the last call without waiting for the rest.
+  std::vector<LoadedChunk> TakeLoaded();
+  // Blocks until every queued save and load has finished.
+  void WaitIdle();
+
+ private:
+  struct Job {
+    glm::ivec2 pos;
+    // empty for a load
+    ChunkCells cells;
+    bool save;
+  };
+
+  void WorkerLoop();
+  [[nodiscard]] std::filesystem::path ChunkPath(glm::ivec2 pos) const;
+  void WriteChunk(glm::ivec2 pos, const ChunkCells& cells) const;
+  [[nodiscard]] std::optional<ChunkCells> ReadChunk(glm::ivec2 pos) const;
+
+  std::filesystem::path dir_;
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable idle_cv_;
+  std::deque<Job> jobs_;
+  std::vector<LoadedChunk> loaded_;
+  // a job was taken off jobs_ and is still running
+  bool busy_{false};
+  bool stop_{false};
+  std::thread worker_;
+};
+
+}  // namespace sand
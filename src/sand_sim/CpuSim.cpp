@@ -0,0 +1,225 @@
+#include "CpuSim.hpp"
+
+#include "sand_sim/Rules.hpp"
+
+namespace sand {
+
+namespace {
+
+constexpr uint32_t kNone = static_cast<uint32_t>(MaterialType::kNone);
+
+}  // namespace
+
+CpuSim::CpuSim(const glm::ivec2& dims, uint32_t num_threads, CpuKernel kernel, SimRules rules)
+    : dims_(dims),
+      kernel_(kernel),
+      rules_(rules),
+      curr_(static_cast<size_t>(dims.x) * dims.y, kNone),
+      prev_(static_cast<size_t>(dims.x) * dims.y, kNone),
+      chunk_rects_(static_cast<size_t>(NumChunks(dims).x) * NumChunks(dims).y),
+      changed_rects_(chunk_rects_.size()),
+      next_chunk_rects_(chunk_rects_.size()),
+      later_chunk_rects_(chunk_rects_.size()),
+      pool_(num_threads),
+      prev_planes_(dims),
+      curr_planes_(dims),
+      stale_rects_(chunk_rects_.size()) {}
+
+void CpuSim::SetGrid(std::span<const uint32_t> grid) {
+  EASSERT_MSG(grid.size() == prev_.size(), "Grid size mismatch");
+  std::copy(grid.begin(), grid.end(), prev_.begin());
+  std::copy(grid.begin(), grid.end(), curr_.begin());
+  if (UsesBitPlanes()) {
+    prev_planes_.Set(grid);
+    curr_planes_.Set(grid);
+  }
+  std::fill(stale_rects_.begin(), stale_rects_.end(), DirtyRect{});
+  for (std::vector<DirtyRect>* rects : {&chunk_rects_, &next_chunk_rects_, &later_chunk_rects_}) {
+    std::fill(rects->begin(), rects->end(), DirtyRect{});
+  }
+  MarkChunks(chunk_rects_, dims_, GridBounds(dims_));
+  // the other block offset
+  if (rules_ == SimRules::kMargolus) MarkChunks(next_chunk_rects_, dims_, GridBounds(dims_));
+}
+
+void CpuSim::CollectAwakeChunks() {
+  awake_chunks_.clear();
+  for (uint32_t i = 0; i < chunk_rects_.size(); i++) {
+    if (!chunk_rects_[i].Empty()) awake_chunks_.emplace_back(i);
+  }
+}
+
+void CpuSim::Step(const std::vector<Modification>& modifications, uint64_t tick) {
+  if (rules_ == SimRules::kMargolus) {
+    StepMargolus(modifications, tick);
+    return;
+  }
+  mod_bins_.Build(modifications, dims_);
+  for (const Modification& mod : modifications) {
+    MarkChunks(chunk_rects_, dims_, ModificationBounds(mod));
+  }
+  CollectAwakeChunks();
+
+  pool_.ParallelFor(static_cast<uint32_t>(awake_chunks_.size()), [&](uint32_t i) {
+    SimulateChunk(awake_chunks_[i], modifications);
+  });
+
+  // A cell can only change next step if a cell within reach of the rules changed this step.
+  // Everything else already holds the same value in both buffers, so it can be skipped.
+  std::fill(next_chunk_rects_.begin(), next_chunk_rects_.end(), DirtyRect{});
+  for (uint32_t chunk_index : awake_chunks_) {
+    const DirtyRect& changed = changed_rects_[chunk_index];
+    if (!changed.Empty()) {
+      MarkChunks(next_chunk_rects_, dims_, WakeRect(changed));
+    }
+  }
+  std::swap(chunk_rects_, next_chunk_rects_);
+  if (UsesBitPlanes()) {
+    std::swap(curr_planes_, prev_planes_);
+  } else {
+    std::swap(curr_, prev_);
+  }
+}
+
+void CpuSim::StepMargolus(const std::vector<Modification>& modifications, uint64_t tick) {
+  for (int pass = 0; pass < kMargolusPasses; pass++) {
+    // modifications land on the first pass
+    std::span<const Modification> pass_modifications;
+    if (pass == 0) pass_modifications = modifications;
+    mod_bins_.Build(pass_modifications, dims_);
+    for (const Modification& mod : pass_modifications) {
+      MarkChunks(chunk_rects_, dims_, AlignToBlocks(ModificationBounds(mod), pass));
+    }
+    CollectAwakeChunks();
+    uint32_t seed = PassSeed(tick, pass, rule_params_.seed);
+    pool_.ParallelFor(static_cast<uint32_t>(awake_chunks_.size()), [&](uint32_t i) {
+      SimulateChunkMargolus(awake_chunks_[i], pass, seed, pass_modifications);
+    });
+
+    // A block can only change if one of its cells changed since the last pass with the same
+    // offset, so changed cells wake the blocks around them for both offsets.
+    int next_offset = (pass + 1) % kMargolusPasses;
+    for (uint32_t chunk_index : awake_chunks_) {
+      const DirtyRect& changed = changed_rects_[chunk_index];
+      if (changed.Empty()) continue;
+      MarkChunks(next_chunk_rects_, dims_, AlignToBlocks(changed, next_offset));
+      MarkChunks(later_chunk_rects_, dims_, AlignToBlocks(changed, pass));
+    }
+    std::swap(chunk_rects_, next_chunk_rects_);
+    std::swap(next_chunk_rects_, later_chunk_rects_);
+    std::fill(later_chunk_rects_.begin(), later_chunk_rects_.end(), DirtyRect{});
+    std::swap(curr_, prev_);
+  }
+}
+
+const std::vector<uint32_t>& CpuSim::GetGrid() {
+  if (!UsesBitPlanes()) return prev_;
+  stale_chunks_.clear();
+  for (uint32_t i = 0; i < stale_rects_.size(); i++) {
+    if (!stale_rects_[i].Empty()) stale_chunks_.emplace_back(i);
+  }
+  // chunks never share cells, so each one can update its part of prev_ in parallel
+  pool_.ParallelFor(static_cast<uint32_t>(stale_chunks_.size()), [&](uint32_t i) {
+    DirtyRect& stale = stale_rects_[stale_chunks_[i]];
+    prev_planes_.Unpack(stale, prev_);
+    stale = {};
+  });
+  return prev_;
+}
+
+void CpuSim::SetKernel(CpuKernel kernel) {
+  if (kernel == kernel_) return;
+  std::vector<uint32_t> grid = GetGrid();
+  kernel_ = kernel;
+  SetGrid(grid);
+}
+
+void CpuSim::SetRules(SimRules rules) {
+  if (rules == rules_) return;
+  std::vector<uint32_t> grid = GetGrid();
+  rules_ = rules;
+  SetGrid(grid);
+}
+
+void CpuSim::SimulateChunk(uint32_t chunk_index, const std::vector<Modification>& modifications) {
+  const DirtyRect& rect = chunk_rects_[chunk_index];
+  std::span<const uint32_t> bin = mod_bins_.Bin(chunk_index);
+  if (UsesBitPlanes()) {
+    DirtyRect changed = SimulateChunkBitPlanes(prev_planes_, curr_planes_, dims_, chunk_index,
+                                               rect, bin, modifications);
+    stale_rects_[chunk_index].Include(changed);
+    changed_rects_[chunk_index] = changed;
+    return;
+  }
+  DirtyRect changed;
+  const uint32_t* input = prev_.data();
+  uint32_t* output = curr_.data();
+  auto get = [&](int x, int y) { return input[static_cast<size_t>(y) * dims_.x + x]; };
+  for (int y = rect.min.y; y <= rect.max.y; y++) {
+    for (int x = rect.min.x; x <= rect.max.x; x++) {
+      uint32_t result = SimulateCell(get, x, y, dims_);
+      for (uint32_t mod_index : bin) {
+        const Modification& mod = modifications[mod_index];
+        if (IsInsideModification(x, y, mod)) {
+          result = static_cast<uint32_t>(mod.cell);
+          break;
+        }
+      }
+      size_t index = static_cast<size_t>(y) * dims_.x + x;
+      if (result != input[index]) changed.Include(x, y);
+      output[index] = result;
+    }
+  }
+  changed_rects_[chunk_index] = changed;
+}
+
+void CpuSim::SimulateChunkMargolus(uint32_t chunk_index, int offset, uint32_t seed,
+                                   std::span<const Modification> modifications) {
+  glm::ivec2 num_chunks = NumChunks(dims_);
+  auto index = static_cast<int>(chunk_index);
+  glm::ivec2 chunk{index % num_chunks.x, index / num_chunks.x};
+  DirtyRect bounds = ChunkBounds(chunk, dims_);
+  DirtyRect blocks = AlignToBlocks(chunk_rects_[chunk_index], offset);
+  const uint32_t* input = prev_.data();
+  uint32_t* output = curr_.data();
+  DirtyRect changed;
+  // bottom left, bottom right, top left, top right
+  constexpr std::array<glm::ivec2, 4> kBlockCells{{{0, 0}, {1, 0}, {0, 1}, {1, 1}}};
+  for (int y = blocks.min.y; y <= blocks.max.y; y += 2) {
+    for (int x = blocks.min.x; x <= blocks.max.x; x += 2) {
+      // A block belongs to the chunk holding its top right cell, clamped to the grid, and may
+      // write into the chunks to the left and below.
+      if (std::min(x + 1, dims_.x - 1) > bounds.max.x ||
+          std::min(y + 1, dims_.y - 1) > bounds.max.y) {
+        continue;
+      }
+      std::array<uint32_t, 4> cells;
+      for (int i = 0; i < 4; i++) {
+        glm::ivec2 pos = glm::ivec2{x, y} + kBlockCells[i];
+        bool in_grid = pos.x >= 0 && pos.y >= 0 && pos.x < dims_.x && pos.y < dims_.y;
+        cells[i] = in_grid ? input[static_cast<size_t>(pos.y) * dims_.x + pos.x] : kOutsideCell;
+      }
+      bool pending = SimulateBlock(cells, RandomBits(seed, {x, y}), rule_params_.fluidity);
+      for (int i = 0; i < 4; i++) {
+        glm::ivec2 pos = glm::ivec2{x, y} + kBlockCells[i];
+        if (pos.x < 0 || pos.y < 0 || pos.x >= dims_.x || pos.y >= dims_.y) continue;
+        if (!modifications.empty()) {
+          glm::ivec2 cell_chunk = pos / kChunkSize;
+          for (uint32_t mod_index : mod_bins_.Bin(cell_chunk.y * num_chunks.x + cell_chunk.x)) {
+            const Modification& mod = modifications[mod_index];
+            if (IsInsideModification(pos.x, pos.y, mod)) {
+              cells[i] = static_cast<uint32_t>(mod.cell);
+              break;
+            }
+          }
+        }
+        size_t cell_index = static_cast<size_t>(pos.y) * dims_.x + pos.x;
+        if (pending || cells[i] != input[cell_index]) changed.Include(pos.x, pos.y);
+        output[cell_index] = cells[i];
+      }
+    }
+  }
+  changed_rects_[chunk_index] = changed;
+}
+
+}  // namespace sand
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "ThreadPool.hpp"
+#include "sand_sim/BitPlaneGrid.hpp"
+#include "sand_sim/Cell.hpp"
+#include "sand_sim/Chunk.hpp"
+#include "sand_sim/Rules.hpp"
+#include "sand_sim/SandSim.hpp"
+
+namespace sand {
+
+// CPU implementation of the rules in demo.cs.glsl and margolus.cs.glsl. The grid is split into
+// chunks and only chunks with a non-empty dirty rect are simulated, in parallel. Like the GPU
+// path, each pass reads prev_ and writes curr_, then swaps. The bit-plane kernel swaps
+// prev_planes_ and curr_planes_ instead and only copies the cells that changed into prev_ when
+// the grid is read.
+class CpuSim {
+ public:
+  CpuSim(const glm::ivec2& dims, uint32_t num_threads, CpuKernel kernel = CpuKernel::kBitPlane,
+         SimRules rules = SimRules::kGather);
+  // Sets both buffers so the next step reads the given grid. Wakes every chunk.
+  void SetGrid(std::span<const uint32_t> grid);
+  // Simulates one tick. The Margolus rules seed their random rolls from tick.
+  void Step(const std::vector<Modification>& modifications, uint64_t tick);
+  // Most recently simulated grid, row major with y = 0 at the bottom.
+  [[nodiscard]] const std::vector<uint32_t>& GetGrid();
+  [[nodiscard]] glm::ivec2 Dims() const { return dims_; }
+  [[nodiscard]] uint32_t NumThreads() const { return pool_.NumThreads(); }
+  // Switches kernels between steps. Wakes every chunk.
+  void SetKernel(CpuKernel kernel);
+  [[nodiscard]] CpuKernel Kernel() const { return kernel_; }
+  // Switches rules between steps. Wakes every chunk.
+  void SetRules(SimRules rules);
+  [[nodiscard]] SimRules Rules() const { return rules_; }
+  // Takes effect on the next step. Only the Margolus rules have parameters.
+  void SetRuleParams(const RuleParams& params) { rule_params_ = params; }
+  // Number of chunks simulated by the last pass.
+  [[nodiscard]] uint32_t NumAwakeChunks() const {
+    return static_cast<uint32_t>(awake_chunks_.size());
+  }
+  // The bit-plane kernel only implements the gather rules.
+  [[nodiscard]] bool UsesBitPlanes() const {
+    return kernel_ == CpuKernel::kBitPlane && rules_ == SimRules::kGather;
+  }
+
+ private:
+  // Collects the chunks with a non-empty rect into awake_chunks_.
+  void CollectAwakeChunks();
+  void StepMargolus(const std::vector<Modification>& modifications, uint64_t tick);
+  void SimulateChunk(uint32_t chunk_index, const std::vector<Modification>& modifications);
+  void SimulateChunkMargolus(uint32_t chunk_index, int offset, uint32_t seed,
+                             std::span<const Modification> modifications);
+  glm::ivec2 dims_;
+  CpuKernel kernel_;
+  SimRules rules_;
+  RuleParams rule_params_;
+  std::vector<uint32_t> curr_;
+  std::vector<uint32_t> prev_;
+  // Cells to simulate this step, per chunk.
+  std::vector<DirtyRect> chunk_rects_;
+  // Cells that changed during the last step, per chunk.
+  std::vector<DirtyRect> changed_rects_;
+  std::vector<DirtyRect> next_chunk_rects_;
+  // Cells to simulate two passes from now. The Margolus rules wake blocks for both block offsets
+  // after a change, since a block that is stable under one offset can move under the other.
+  std::vector<DirtyRect> later_chunk_rects_;
+  std::vector<uint32_t> awake_chunks_;
+  ModificationBins mod_bins_;
+  ThreadPool pool_;
+  BitPlaneGrid prev_planes_;
+  BitPlaneGrid curr_planes_;
+  // Cells per chunk where prev_ lags behind prev_planes_.
+  std::vector<DirtyRect> stale_rects_;
+  std::vector<uint32_t> stale_chunks_;
+};
+
+}  // namespace sand
@@ -0,0 +1,35 @@
+#include "GpuSim.hpp"
+
+#include "Path.hpp"
+#include "gl/ShaderManager.hpp"
+#include "sand_sim/Material.hpp"
+
+namespace sand {
+
+void AddSimKernels() {
+  gl::ShaderDefines defines{{"CHUNK_SIZE", std::to_string(kChunkSize)}};
+  std::ranges::copy(MaterialDefines(), std::back_inserter(defines));
+  gl::ShaderManager::Get().AddShader(
+      "chunk_compact",
+      {{GET_SHADER_PATH("chunk_compact.cs.glsl"), gl::ShaderType::kCompute, defines}});
+  gl::ShaderManager::Get().AddShader(
+      "demo", {{GET_SHADER_PATH("demo.cs.glsl"), gl::ShaderType::kCompute, defines}});
+  gl::ShaderManager::Get().AddShader(
+      "margolus", {{GET_SHADER_PATH("margolus.cs.glsl"), gl::ShaderType::kCompute, defines}});
+}
+
+std::vector<GpuChunk> AwakeGpuChunks(const glm::ivec2& dims, SimRules rules) {
+  glm::ivec2 num_chunks = NumChunks(dims);
+  std::vector<GpuChunk> chunks(static_cast<size_t>(num_chunks.x) * num_chunks.y);
+  for (int y = 0; y < num_chunks.y; y++) {
+    for (int x = 0; x < num_chunks.x; x++) {
+      GpuChunk& chunk = chunks[y * num_chunks.x + x];
+      chunk.next_rect = ChunkBounds({x, y}, dims);
+      // the second Margolus pass has the other block offset
+      if (rules == SimRules::kMargolus) chunk.later_rect = chunk.next_rect;
+    }
+  }
+  return chunks;
+}
+
+}  // namespace sand
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "sand_sim/Chunk.hpp"
+#include "sand_sim/SandSim.hpp"
+
+namespace sand {
+
+// Declarations shared by the GPU paths of SandSim and BatchSim, which run the same kernels.
+
+// Mirrors the Chunk struct in sim_common.glsl
+struct GpuChunk {
+  DirtyRect rect;
+  DirtyRect next_rect;
+  DirtyRect later_rect;
+};
+static_assert(sizeof(GpuChunk) == 12 * sizeof(int), "GpuChunk must match the std430 layout");
+
+// Mirrors the std140 SimParams block in sim_common.glsl, which only holds 4 byte scalars.
+struct SimParams {
+  int32_t grid_size_x;
+  int32_t grid_size_y;
+  int32_t num_chunks_x;
+  int32_t num_chunks_y;
+  int32_t groups_per_chunk_x;
+  int32_t modification_count;
+  int32_t block_offset;
+  uint32_t seed;
+  uint32_t tick;
+  int32_t num_worlds;
+};
+static_assert(sizeof(SimParams) == 10 * sizeof(int32_t), "SimParams must match the std140 layout");
+
+// local_size_x of chunk_compact.cs.glsl
+constexpr int kCompactGroupSize = 64;
+
+// Adds chunk_compact, demo and margolus with the defines that never change. The defines that
+// vary at runtime select permutations of them.
+void AddSimKernels();
+
+// Work groups needed to cover one chunk, one invocation per cell for the gather kernel and one
+// per 2x2 block for the Margolus passes. Those get one more block, which only the last chunk
+// column and row use on offset 1 passes when the grid ends on a chunk edge: its top right cell
+// is outside the grid, and like in CpuSim the clamped one is in the last chunk.
+inline glm::ivec2 GroupsPerChunk(SimRules rules, const glm::ivec2& work_group_size) {
+  glm::ivec2 invocations{rules == SimRules::kMargolus ? kChunkSize / 2 + 1 : kChunkSize};
+  return (invocations + work_group_size - glm::ivec2{1}) / work_group_size;
+}
+
+// Every chunk of a grid awake for the next pass, as the GPU chunk buffer holds them.
+std::vector<GpuChunk> AwakeGpuChunks(const glm::ivec2& dims, SimRules rules);
+
+}  // namespace sand
@@ -0,0 +1,137 @@
+#include "InputLog.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+namespace sand {
+
+namespace {
+
+// bytes per modification in a record
+constexpr size_t kModificationBytes = 2 * sizeof(int32_t) + sizeof(float) + 2;
+
+template <typename T>
+void Append(std::vector<std::byte>& out, const T& value) {
+  size_t offset = out.size();
+  out.resize(offset + sizeof(T));
+  std::memcpy(out.data() + offset, &value, sizeof(T));
+}
+
+template <typename T>
+bool Read(const std::vector<std::byte>& data, size_t& offset, T& value) {
+  if (data.size() - offset < sizeof(T)) return false;
+  std::memcpy(&value, data.data() + offset, sizeof(T));
+  offset += sizeof(T);
+  return true;
+}
+
+}  // namespace
+
+InputRecorder::~InputRecorder() {
+  if (file_) std::fclose(file_);
+}
+
+bool InputRecorder::Open(const std::string& path, const glm::ivec2& dims) {
+  EASSERT_MSG(!file_, "InputRecorder is already open");
+  path_ = path;
+  failed_ = false;
+  file_ = std::fopen(path.c_str(), "wb");
+  if (!file_) {
+    spdlog::error("Failed to open {} for writing", path);
+    return false;
+  }
+  InputLogHeader header{.width = dims.x, .height = dims.y};
+  failed_ = std::fwrite(&header, sizeof(header), 1, file_) != 1;
+  return !failed_;
+}
+
+void InputRecorder::Record(uint64_t tick, std::span<const Modification> modifications) {
+  if (!file_ || modifications.empty()) return;
+  record_.clear();
+  Append(record_, tick);
+  Append(record_, static_cast<uint32_t>(modifications.size()));
+  for (const Modification& mod : modifications) {
+    Append(record_, static_cast<int32_t>(mod.x));
+    Append(record_, static_cast<int32_t>(mod.y));
+    Append(record_, mod.radius);
+    Append(record_, static_cast<uint8_t>(mod.shape));
+    Append(record_, static_cast<uint8_t>(mod.cell));
+  }
+  failed_ |= std::fwrite(record_.data(), 1, record_.size(), file_) != record_.size();
+}
+
+bool InputRecorder::Close() {
+  if (!file_) return false;
+  bool ok = std::fclose(file_) == 0 && !failed_;
+  file_ = nullptr;
+  if (!ok) spdlog::error("Failed to write input log {}", path_);
+  return ok;
+}
+
+std::optional<InputReplay> InputReplay::Open(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    spdlog::error("Failed to open input log {}", path);
+    return std::nullopt;
+  }
+  std::vector<std::byte> data;
+  file.seekg(0, std::ios::end);
+  data.resize(static_cast<size_t>(file.tellg()));
+  file.seekg(0);
+  file.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size()));
+
+  size_t offset = 0;
+  InputLogHeader header;
+  if (!Read(data, offset, header) || header.magic != kInputLogMagic) {
+    spdlog::error("{} is not an input log", path);
+    return std::nullopt;
+  }
+  if (header.version != kInputLogVersion) {
+    spdlog::error("Input log {} has version {}, expected {}", path, header.version,
+                  kInputLogVersion);
+    return std::nullopt;
+  }
+  InputReplay replay;
+  replay.dims_ = {header.width, header.height};
+  while (offset < data.size()) {
+    Record record;
+    uint32_t count = 0;
+    if (!Read(data, offset, record.tick) || !Read(data, offset, count) ||
+        (data.size() - offset) / kModificationBytes < count) {
+      spdlog::error("Input log {} is truncated", path);
+      return std::nullopt;
+    }
+    record.modifications.resize(count);
+    for (Modification& mod : record.modifications) {
+      int32_t x, y;
+      uint8_t shape, cell;
+      Read(data, offset, x);
+      Read(data, offset, y);
+      Read(data, offset, mod.radius);
+      Read(data, offset, shape);
+      Read(data, offset, cell);
+      mod.x = x;
+      mod.y = y;
+      mod.shape = static_cast<ModificationShape>(shape);
+      mod.cell = cell;
+    }
+    replay.records_.emplace_back(std::move(record));
+  }
+  return replay;
+}
+
+void InputReplay::Take(uint64_t tick, std::vector<Modification>& out) {
+  while (next_ < records_.size() && records_[next_].tick <= tick) {
+    const Record& record = records_[next_++];
+    if (record.tick == tick) {
+      out.insert(out.end(), record.modifications.begin(), record.modifications.end());
+    }
+  }
+}
+
+uint64_t InputReplay::NextTick() const {
+  return Done() ? std::numeric_limits<uint64_t>::max() : records_[next_].tick;
+}
+
+}  // namespace sand
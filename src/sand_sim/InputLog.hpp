@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdio>
+#include <span>
+
+#include "sand_sim/Cell.hpp"
+
+namespace sand {
+
+constexpr uint32_t kInputLogMagic = 0x474f4c53;  // "SLOG"
+constexpr uint32_t kInputLogVersion = 1;
+
+// Start of every input log. Followed by one record per tick that had modifications: the tick as
+// uint64_t, the modification count as uint32_t, then each modification as x, y (int32_t),
+// radius (float), shape and cell (uint8_t), all in host byte order.
+struct InputLogHeader {
+  uint32_t magic{kInputLogMagic};
+  uint32_t version{kInputLogVersion};
+  int32_t width{0};
+  int32_t height{0};
+};
+static_assert(sizeof(InputLogHeader) == 16, "InputLogHeader is written to disk as is");
+
+// Appends the modifications applied on each tick to a log file.
+class InputRecorder {
+ public:
+  InputRecorder() = default;
+  InputRecorder(const InputRecorder& other) = delete;
+  InputRecorder& operator=(const InputRecorder& other) = delete;
+  ~InputRecorder();
+
+  bool Open(const std::string& path, const glm::ivec2& dims);
+  void Record(uint64_t tick, std::span<const Modification> modifications);
+  // Returns false if any write failed.
+  bool Close();
+  [[nodiscard]] bool IsOpen() const { return file_ != nullptr; }
+
+ private:
+  std::FILE* file_{nullptr};
+  std::string path_;
+  std::vector<std::byte> record_;
+  bool failed_{false};
+};
+
+// A whole input log read into memory, handed out tick by tick.
+class InputReplay {
+ public:
+  // Logs and returns nullopt if the file can't be read or isn't a valid log.
+  static std::optional<InputReplay> Open(const std::string& path);
+
+  // Appends the modifications recorded for tick to out. Records before tick are skipped.
+  void Take(uint64_t tick, std::vector<Modification>& out);
+  // Tick of the next record, or UINT64_MAX once the log is exhausted.
+  [[nodiscard]] uint64_t NextTick() const;
+  [[nodiscard]] bool Done() const { return next_ == records_.size(); }
+  [[nodiscard]] glm::ivec2 Dims() const { return dims_; }
+
+ private:
+  struct Record {
+    uint64_t tick;
+    std::vector<Modification> modifications;
+  };
+  glm::ivec2 dims_{};
+  std::vector<Record> records_;
+  size_t next_{0};
+};
+
+}  // namespace sand
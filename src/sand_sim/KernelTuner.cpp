@@ -0,0 +1,158 @@
+#include "KernelTuner.hpp"
+
+#include <fstream>
+#include <sstream>
+
+#include "gl/ShaderManager.hpp"
+#include "sand_sim/Scenario.hpp"
+
+namespace sand {
+
+namespace {
+
+// Ticks run before timing a candidate, which also compiles its permutation.
+constexpr uint32_t kWarmupTicks = 8;
+constexpr uint32_t kTimedTicks = 32;
+// The fastest of these runs counts, the others absorb clock changes and other load.
+constexpr int kTimedRuns = 3;
+
+// FNV-1a
+uint64_t HashString(std::string_view str) {
+  uint64_t hash = 14695981039346656037ull;
+  for (char c : str) hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+  return hash;
+}
+
+const char* RulesName(SimRules rules) {
+  return rules == SimRules::kGather ? "gather" : "margolus";
+}
+
+const char* CellFormatName(CellFormat cell_format) {
+  return cell_format == CellFormat::kR32ui ? "r32" : "r8";
+}
+
+const char* KernelName(KernelVariant kernel) {
+  return kernel == KernelVariant::kTiled ? "tiled" : "basic";
+}
+
+// Warps are 32 invocations and wavefronts 32 or 64, so every shape fills whole ones. 10x10 was
+// the old default and stays in as the baseline.
+std::vector<glm::ivec2> CandidateWorkGroupSizes() {
+  std::vector<glm::ivec2> sizes{{10, 10}};
+  for (int invocations = 32; invocations <= 256; invocations *= 2) {
+    for (int x = 2; x <= 32; x *= 2) {
+      int y = invocations / x;
+      if (y >= 2 && y <= 32) sizes.emplace_back(x, y);
+    }
+  }
+  return sizes;
+}
+
+}  // namespace
+
+KernelTuner::KernelTuner(std::filesystem::path cache_path)
+    : cache_path_(std::move(cache_path)),
+      driver_(HashString(gl::ShaderManager::Get().DriverId())) {
+  std::ifstream file(cache_path_);
+  // never tuned
+  if (!file) return;
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line.starts_with('#')) continue;
+    std::istringstream stream(line);
+    Entry entry{};
+    std::string rules, cell_format, kernel;
+    stream >> std::hex >> entry.driver >> std::dec >> rules >> cell_format >>
+        entry.config.work_group_size.x >> entry.config.work_group_size.y >> kernel;
+    if (!stream || entry.config.work_group_size.x <= 0 || entry.config.work_group_size.y <= 0) {
+      spdlog::error("Ignoring malformed kernel tuning entry in {}: {}", cache_path_.string(), line);
+      continue;
+    }
+    entry.rules = rules == "gather" ? SimRules::kGather : SimRules::kMargolus;
+    entry.cell_format = cell_format == "r32" ? CellFormat::kR32ui : CellFormat::kR8ui;
+    entry.config.kernel = kernel == "tiled" ? KernelVariant::kTiled : KernelVariant::kBasic;
+    entries_.emplace_back(entry);
+  }
+}
+
+std::optional<KernelConfig> KernelTuner::Lookup(SimRules rules, CellFormat cell_format) const {
+  for (const Entry& entry : entries_) {
+    if (entry.driver == driver_ && entry.rules == rules && entry.cell_format == cell_format) {
+      return entry.config;
+    }
+  }
+  return std::nullopt;
+}
+
+KernelConfig KernelTuner::Tune(const glm::ivec2& dims, SimRules rules, CellFormat cell_format) {
+  SandSim sim;
+  sim.Start({.dims = dims,
+             .work_group_size = {8, 8},
+             .backend = SimBackend::kGpu,
+             .rules = rules,
+             .cell_format = cell_format,
+             .headless = true});
+  // sand everywhere keeps every chunk awake for the whole run
+  std::vector<uint32_t> grid(static_cast<size_t>(dims.x) * dims.y, 0);
+  FindScenario("noise")->init(grid, dims);
+
+  // Margolus has a single kernel
+  std::vector<KernelVariant> kernels{KernelVariant::kBasic};
+  if (rules == SimRules::kGather) kernels.emplace_back(KernelVariant::kTiled);
+  GLuint query;
+  glCreateQueries(GL_TIME_ELAPSED, 1, &query);
+  std::optional<KernelConfig> best;
+  uint64_t best_ns = std::numeric_limits<uint64_t>::max();
+  for (KernelVariant kernel : kernels) {
+    for (const glm::ivec2& work_group_size : CandidateWorkGroupSizes()) {
+      // a candidate that failed reverts the kernel too
+      sim.SetKernel(kernel);
+      // beyond what the device allows, or failed to compile
+      if (!sim.SetWorkGroupSize(work_group_size)) continue;
+      sim.SetGrid(grid);
+      sim.Simulate(kWarmupTicks);
+      uint64_t candidate_ns = std::numeric_limits<uint64_t>::max();
+      for (int run = 0; run < kTimedRuns; run++) {
+        glBeginQuery(GL_TIME_ELAPSED, query);
+        sim.Simulate(kTimedTicks);
+        glEndQuery(GL_TIME_ELAPSED);
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+        candidate_ns = std::min<uint64_t>(candidate_ns, ns);
+      }
+      spdlog::info("Work group {}x{} {}: {:.3f} ms per tick", work_group_size.x,
+                   work_group_size.y, KernelName(kernel),
+                   static_cast<double>(candidate_ns) / kTimedTicks / 1e6);
+      if (candidate_ns < best_ns) {
+        best_ns = candidate_ns;
+        best = KernelConfig{.work_group_size = work_group_size, .kernel = kernel};
+      }
+    }
+  }
+  glDeleteQueries(1, &query);
+  EASSERT_MSG(best.has_value(), "No work group size is supported");
+  spdlog::info("Tuned {} {} kernels: work group {}x{} {}", RulesName(rules),
+               CellFormatName(cell_format), best->work_group_size.x, best->work_group_size.y,
+               KernelName(best->kernel));
+
+  std::erase_if(entries_, [&](const Entry& entry) {
+    return entry.driver == driver_ && entry.rules == rules && entry.cell_format == cell_format;
+  });
+  entries_.push_back(
+      {.driver = driver_, .rules = rules, .cell_format = cell_format, .config = *best});
+  Save();
+  return *best;
+}
+
+void KernelTuner::Save() const {
+  std::ofstream file(cache_path_, std::ios::trunc);
+  file << "# driver rules cell_format work_group_x work_group_y kernel\n";
+  for (const Entry& entry : entries_) {
+    file << fmt::format("{:016x} {} {} {} {} {}\n", entry.driver, RulesName(entry.rules),
+                        CellFormatName(entry.cell_format), entry.config.work_group_size.x,
+                        entry.config.work_group_size.y, KernelName(entry.config.kernel));
+  }
+  if (!file) spdlog::error("Failed to write kernel tuning cache {}", cache_path_.string());
+}
+
+}  // namespace sand
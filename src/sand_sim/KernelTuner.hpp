@@ -0,0 +1,43 @@
+#pragma once
+
+#include <filesystem>
+
+#include "sand_sim/SandSim.hpp"
+
+namespace sand {
+
+// GPU kernel configuration picked by KernelTuner.
+struct KernelConfig {
+  glm::ivec2 work_group_size;
+  KernelVariant kernel{KernelVariant::kBasic};
+};
+
+// Times every candidate work group size and kernel variant on the current GL device and keeps
+// the fastest. Winners are cached in a small text file per driver, rules and cell format, so
+// only the first run on a device pays for tuning. Needs the ShaderManager.
+class KernelTuner {
+ public:
+  explicit KernelTuner(std::filesystem::path cache_path);
+  // The cached winner for the current driver, nullopt if this device was never tuned.
+  [[nodiscard]] std::optional<KernelConfig> Lookup(SimRules rules, CellFormat cell_format) const;
+  // Benchmarks the candidates on a headless sim of dims with GL_TIME_ELAPSED queries, waiting
+  // for each, and caches the winner. Takes a second or two on a board of screen size.
+  KernelConfig Tune(const glm::ivec2& dims, SimRules rules, CellFormat cell_format);
+
+ private:
+  struct Entry {
+    uint64_t driver;
+    SimRules rules;
+    CellFormat cell_format;
+    KernelConfig config;
+  };
+
+  void Save() const;
+
+  std::filesystem::path cache_path_;
+  std::vector<Entry> entries_;
+  // hash of ShaderManager::DriverId()
+  uint64_t driver_;
+};
+
+}  // namespace sand
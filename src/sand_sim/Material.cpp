@@ -0,0 +1,46 @@
+#include "Material.hpp"
+
+namespace sand {
+
+namespace {
+
+// One uint per first material with bit i set when the pair with material i is in the table.
+std::string PairMasks(const std::array<bool, kMaterialSlots * kMaterialSlots>& pairs) {
+  std::string masks;
+  for (size_t first = 0; first < kMaterialSlots; first++) {
+    uint32_t mask = 0;
+    for (size_t second = 0; second < kMaterialSlots; second++) {
+      if (pairs[first * kMaterialSlots + second]) mask |= 1u << second;
+    }
+    if (!masks.empty()) masks += ", ";
+    masks += fmt::format("{}u", mask);
+  }
+  return masks;
+}
+
+}  // namespace
+
+std::vector<std::pair<std::string, std::string>> MaterialDefines() {
+  std::vector<std::pair<std::string, std::string>> defines;
+  std::string colors;
+  for (const MaterialDef& def : kMaterials) {
+    defines.emplace_back(fmt::format("MAT_{}", def.name),
+                         std::to_string(static_cast<int>(def.type)));
+    if (!colors.empty()) colors += ", ";
+    colors += fmt::format("vec3({}, {}, {})", def.color[0], def.color[1], def.color[2]);
+  }
+  std::string fluidity;
+  for (uint8_t value : kFluidity) {
+    if (!fluidity.empty()) fluidity += ", ";
+    fluidity += fmt::format("{}u", value);
+  }
+  defines.emplace_back("NUM_MATERIALS", std::to_string(kMaterials.size()));
+  defines.emplace_back("MATERIAL_COLOR", colors);
+  defines.emplace_back("MATERIAL_SINKS", PairMasks(kSinks));
+  defines.emplace_back("MATERIAL_SPREADS", PairMasks(kSpreads));
+  defines.emplace_back("MATERIAL_FLUIDITY", fluidity);
+  defines.emplace_back("ANY_FLUID", kAnyFluid ? "1" : "0");
+  return defines;
+}
+
+}  // namespace sand
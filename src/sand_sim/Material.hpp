@@ -0,0 +1,114 @@
+#pragma once
+
+#include <array>
+#include <string_view>
+
+#include "sand_sim/Cell.hpp"
+
+namespace sand {
+
+enum class Gravity : int8_t { kDown = -1, kNone = 0, kUp = 1 };
+
+// One row of the material table. Both simulation backends and the renderer are generated from
+// kMaterials, so adding a material only means adding a row here and a MaterialType value.
+struct MaterialDef {
+  MaterialType type;
+  // Suffix of the MAT_ define in the shaders.
+  std::string_view name;
+  // A falling material sinks through lighter ones, a rising one floats up through heavier ones.
+  uint8_t density;
+  Gravity gravity;
+  // Chance out of 256 that the material moves sideways into a lighter neighbor on a Margolus
+  // pass, 0 for never. The gather rules only move cells vertically and ignore it.
+  uint8_t fluidity;
+  // Base color, darkened by the cell's color index.
+  std::array<float, 3> color;
+};
+
+inline constexpr std::array kMaterials = std::to_array<MaterialDef>({
+    {MaterialType::kNone, "None", 0, Gravity::kNone, 0, {0, 0, 0}},
+    {MaterialType::kSand, "Sand", 2, Gravity::kDown, 0, {1, 1, 0}},
+    {MaterialType::kWater, "Water", 1, Gravity::kDown, 200, {0, 0, 1}},
+});
+
+// Cells hold 4 bits of material, so the lookup tables cover every value.
+constexpr size_t kMaterialSlots = 16;
+static_assert(kMaterials.size() <= kMaterialSlots, "Materials must fit in 4 bits");
+
+constexpr bool MaterialTableInOrder() {
+  for (size_t i = 0; i < kMaterials.size(); i++) {
+    if (static_cast<size_t>(kMaterials[i].type) != i) return false;
+  }
+  return true;
+}
+static_assert(MaterialTableInOrder(), "kMaterials must be indexed by MaterialType");
+
+template <MaterialType M>
+struct MaterialTraits {
+  static constexpr const MaterialDef& kDef = kMaterials[static_cast<size_t>(M)];
+  static constexpr uint8_t kDensity = kDef.density;
+  static constexpr Gravity kGravity = kDef.gravity;
+  static constexpr bool kFluid = kDef.fluidity > 0;
+};
+
+// Whether a cell of material upper swaps with the cell of material lower right below it, given
+// both are free to move. Materials past the table never swap.
+constexpr bool MaterialSinks(size_t upper, size_t lower) {
+  if (upper >= kMaterials.size() || lower >= kMaterials.size()) return false;
+  const MaterialDef& u = kMaterials[upper];
+  const MaterialDef& l = kMaterials[lower];
+  return u.density > l.density && (u.gravity == Gravity::kDown || l.gravity == Gravity::kUp);
+}
+
+// Whether a cell of material from moves sideways into the cell of material to next to it.
+constexpr bool MaterialSpreads(size_t from, size_t to) {
+  if (from >= kMaterials.size() || to >= kMaterials.size()) return false;
+  return kMaterials[from].fluidity > 0 && kMaterials[from].density > kMaterials[to].density;
+}
+
+// Whether any material spreads sideways. The sideways rules are compiled out of the Margolus
+// kernels otherwise.
+inline constexpr bool kAnyFluid = [] {
+  for (const MaterialDef& def : kMaterials) {
+    if (def.fluidity > 0) return true;
+  }
+  return false;
+}();
+
+// MaterialSinks for every pair of 4 bit materials, indexed by upper * kMaterialSlots + lower.
+inline constexpr std::array<bool, kMaterialSlots * kMaterialSlots> kSinks = [] {
+  std::array<bool, kMaterialSlots * kMaterialSlots> sinks{};
+  for (size_t upper = 0; upper < kMaterialSlots; upper++) {
+    for (size_t lower = 0; lower < kMaterialSlots; lower++) {
+      sinks[upper * kMaterialSlots + lower] = MaterialSinks(upper, lower);
+    }
+  }
+  return sinks;
+}();
+
+// MaterialSpreads for every pair of 4 bit materials, indexed by from * kMaterialSlots + to.
+inline constexpr std::array<bool, kMaterialSlots * kMaterialSlots> kSpreads = [] {
+  std::array<bool, kMaterialSlots * kMaterialSlots> spreads{};
+  for (size_t from = 0; from < kMaterialSlots; from++) {
+    for (size_t to = 0; to < kMaterialSlots; to++) {
+      spreads[from * kMaterialSlots + to] = MaterialSpreads(from, to);
+    }
+  }
+  return spreads;
+}();
+
+// Fluidity of every 4 bit material, 0 past the table.
+inline constexpr std::array<uint8_t, kMaterialSlots> kFluidity = [] {
+  std::array<uint8_t, kMaterialSlots> fluidity{};
+  for (size_t i = 0; i < kMaterials.size(); i++) fluidity[i] = kMaterials[i].fluidity;
+  return fluidity;
+}();
+
+// The material table as shader defines: MAT_<name> per material, NUM_MATERIALS,
+// MATERIAL_COLOR with one vec3 per material, MATERIAL_SINKS and MATERIAL_SPREADS with one uint
+// per material holding kSinks and kSpreads for every other material as bits, MATERIAL_FLUIDITY
+// with kFluidity, and ANY_FLUID. The rules look pairs up instead of branching on materials, so a
+// material only costs what its own row enables.
+std::vector<std::pair<std::string, std::string>> MaterialDefines();
+
+}  // namespace sand
@@ -0,0 +1,35 @@
+#pragma once
+
+namespace sand {
+
+// Stateless counter-based random numbers. Every value is a hash of a seed and a counter, such as
+// a cell position, so each thread or invocation draws its own without shared state and a rerun
+// draws the same values. Must match random.glsl, so the CPU and GPU kernels draw identical
+// streams and random rules stay comparable across backends. A draw costs a few multiplies and
+// shifts per hash.
+
+// Integer hash from https://github.com/skeeto/hash-prospector. Hash(0) is 0.
+inline uint32_t Hash(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return x;
+}
+
+// 32 random bits for counter under seed.
+inline uint32_t RandomBits(uint32_t seed, uint32_t counter) { return Hash(counter ^ Hash(seed)); }
+
+// 32 random bits for the cell or block at pos under seed. Fold the tick into the seed for a new
+// draw every tick.
+inline uint32_t RandomBits(uint32_t seed, glm::ivec2 pos) {
+  return Hash(static_cast<uint32_t>(pos.x) ^ Hash(static_cast<uint32_t>(pos.y) ^ Hash(seed)));
+}
+
+// Maps random bits to [0, n) with a multiply instead of a modulo, which would favor small values.
+inline uint32_t RandomBelow(uint32_t bits, uint32_t n) {
+  return static_cast<uint32_t>((static_cast<uint64_t>(bits) * n) >> 32);
+}
+
+}  // namespace sand
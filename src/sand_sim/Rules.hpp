@@ -0,0 +1,129 @@
+#pragma once
+
+#include <array>
+
+#include "sand_sim/Chunk.hpp"
+#include "sand_sim/Material.hpp"
+#include "sand_sim/Random.hpp"
+
+namespace sand {
+
+// Rows the rules read below and above a cell. A change at row y can only affect rows
+// y - kReachAbove through y + kReachBelow on the next tick.
+constexpr int kReachBelow = 2;
+constexpr int kReachAbove = 1;
+
+// Cells that may change on the tick after the cells in changed did.
+inline DirtyRect WakeRect(const DirtyRect& changed) {
+  return {changed.min - glm::ivec2{1, kReachAbove}, changed.max + glm::ivec2{1, kReachBelow}};
+}
+
+inline bool Sinks(uint32_t upper, uint32_t lower) {
+  return kSinks[(upper & 0xf) * kMaterialSlots + (lower & 0xf)];
+}
+
+// The rules of simulate() in demo.cs.glsl. get(x, y) returns the cell at x, y and is only called
+// inside the grid. A cell swaps with the one below it when it sinks into it, unless that one is
+// itself swapping further down this tick, so no cell takes part in two swaps.
+template <typename GetCell>
+uint32_t SimulateCell(const GetCell& get, int x, int y, const glm::ivec2& dims) {
+  uint32_t cell = get(x, y);
+  uint32_t below = y > 0 ? get(x, y - 1) : 0;
+  bool sinks = y > 0 && Sinks(cell, below);
+  if (y < dims.y - 1) {
+    uint32_t above = get(x, y + 1);
+    if (!sinks && Sinks(above, cell)) return above;
+  }
+  if (sinks && !(y > 1 && Sinks(below, get(x, y - 2)))) return below;
+  return cell;
+}
+
+// Margolus rules, see margolus.cs.glsl. Each pass splits the grid into 2x2 blocks, shifted by
+// the pass's block offset, and rearranges the cells inside each block. Blocks never share cells,
+// so every block can run in parallel, and since the rules only swap cells nothing is lost or
+// duplicated.
+
+// Stands in for cells of a block outside the grid. Its material is past the table, so it never
+// moves and nothing moves into it.
+constexpr uint32_t kOutsideCell = 0xf;
+
+// Margolus passes per tick, with block offsets 0 and 1.
+constexpr int kMargolusPasses = 2;
+
+// The blocks of a pass start at cells where x + offset and y + offset are even. Grows rect to
+// whole blocks.
+inline DirtyRect AlignToBlocks(const DirtyRect& rect, int offset) {
+  if (rect.Empty()) return rect;
+  auto parity = [](const glm::ivec2& v) { return glm::ivec2{v.x & 1, v.y & 1}; };
+  return {rect.min - parity(rect.min + glm::ivec2{offset}),
+          rect.max + parity(rect.max + glm::ivec2{offset + 1})};
+}
+
+inline bool Spreads(uint32_t from, uint32_t to) {
+  return kSpreads[(from & 0xf) * kMaterialSlots + (to & 0xf)];
+}
+
+// Margolus rule parameters that may differ between the worlds of a BatchSim. The defaults are
+// the rules of kMaterials.
+struct RuleParams {
+  // mixed into the seed of every pass, so worlds that start alike still roll differently
+  uint32_t seed{0};
+  // chance out of 256 per material of moving sideways, only for materials that spread at all
+  std::array<uint8_t, kMaterialSlots> fluidity{kFluidity};
+};
+
+// Seed of a pass, under which each block draws RandomBits at its bottom left cell. Must match
+// margolus.cs.glsl. Hash(0) is 0, so a zero params seed leaves tick * kMargolusPasses + pass as
+// is.
+inline uint32_t PassSeed(uint64_t tick, int pass, uint32_t params_seed) {
+  return static_cast<uint32_t>(tick * kMargolusPasses + pass) ^ Hash(params_seed);
+}
+
+// Applies the Margolus rules to the cells of one block: bottom left, bottom right, top left, top
+// right. Must match simulate_block() in margolus.cs.glsl. Returns true if a cell passed up a
+// sideways move on its roll, which has to keep the block awake.
+inline bool SimulateBlock(std::array<uint32_t, 4>& cells, uint32_t random,
+                          const std::array<uint8_t, kMaterialSlots>& fluidity = kFluidity) {
+  std::array<bool, 4> moved{};
+  // straight down
+  for (int column = 0; column < 2; column++) {
+    if (Sinks(cells[column + 2], cells[column])) {
+      std::swap(cells[column + 2], cells[column]);
+      moved[column] = moved[column + 2] = true;
+    }
+  }
+  // diagonally down past a lighter cell, which piles granular materials at 45 degrees
+  if (!moved[0] && !moved[1]) {
+    for (int column = 0; column < 2; column++) {
+      int other = 1 - column;
+      if (Sinks(cells[column + 2], cells[other]) && Sinks(cells[column + 2], cells[other + 2])) {
+        std::swap(cells[column + 2], cells[other]);
+        moved[column + 2] = moved[other] = true;
+        break;
+      }
+    }
+  }
+  // sideways within a row, one random byte per row
+  bool pending = false;
+  if constexpr (kAnyFluid) {
+    for (int row = 0; row < 4; row += 2) {
+      if (moved[row] || moved[row + 1]) continue;
+      uint32_t from;
+      if (Spreads(cells[row], cells[row + 1])) {
+        from = cells[row];
+      } else if (Spreads(cells[row + 1], cells[row])) {
+        from = cells[row + 1];
+      } else {
+        continue;
+      }
+      if (((random >> (row * 4)) & 0xff) < fluidity[from & 0xf]) {
+        std::swap(cells[row], cells[row + 1]);
+      } else {
+        pending = true;
+      }
+    }
+  }
+  return pending;
+}
+
+}  // namespace sand
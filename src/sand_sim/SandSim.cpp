@@ -3,138 +3,1143 @@
 #include <imgui.h>
 
 #include "Input.hpp"
+#include "Path.hpp"
 #include "Window.hpp"
 #include "gl/Buffer.hpp"
+#include "gl/GpuProfiler.hpp"
+#include "gl/RingBuffer.hpp"
 #include "gl/ShaderManager.hpp"
 #include "gl/Texture.hpp"
 #include "pch.hpp"
+#include "sand_sim/Cell.hpp"
+#include "sand_sim/Chunk.hpp"
+#include "sand_sim/ChunkStore.hpp"
+#include "sand_sim/CpuSim.hpp"
+#include "sand_sim/GpuSim.hpp"
+#include "sand_sim/InputLog.hpp"
+#include "sand_sim/Material.hpp"
+#include "sand_sim/Rules.hpp"
+#include "sand_sim/SimThread.hpp"
+#include "sand_sim/Snapshot.hpp"
 
 namespace sand {
 
-enum class MaterialType : uint8_t { kNone = 0, kSand = 1, kWater = 2 };
+namespace {
 
-struct CellData {
-  MaterialType material_type : 4;
-  uint8_t color_index : 4;
-  [[nodiscard]] uint32_t Pack() const { return Pack(material_type, color_index); }
-  static uint32_t Pack(MaterialType material_type, uint8_t color_index) {
-    return static_cast<uint8_t>(material_type) | color_index << 4;
-    // return static_cast<uint8_t>(material_type) << 4 | color_index;
-  }
+// Mirrors the StatsBuffer block in stats.cs.glsl
+struct GpuStats {
+  std::array<uint32_t, kMaterialSlots> material_counts;
+  uint32_t changed_cells;
+  DirtyRect changed_rect;
 };
-enum class ModificationShape : uint32_t { kCircle, kSquare };
-struct Modification {
-  int x, y;
-  float radius{10};
-  ModificationShape shape;
-  int cell{1};
+static_assert(sizeof(GpuStats) == 21 * sizeof(uint32_t), "GpuStats must match the std430 layout");
+
+// local_size_x and local_size_y of stats.cs.glsl
+constexpr int kStatsGroupSize = 16;
+
+// Mirrors the std140 WorldGenParams block in worldgen.cs.glsl
+struct GpuWorldGenParams {
+  uint32_t kind;
+  uint32_t material;
+  uint32_t seed;
+  uint32_t density;
+  int32_t base_height;
+  int32_t amplitude;
+  int32_t feature_size;
+  uint32_t fluid;
+  int32_t fluid_level;
+  int32_t num_layers;
+  int32_t padding[2];
+  std::array<glm::ivec4, kMaxWorldGenLayers> layers;
 };
+static_assert(sizeof(GpuWorldGenParams) == (12 + 4 * kMaxWorldGenLayers) * sizeof(int32_t),
+              "GpuWorldGenParams must match the std140 layout");
+
+// local_size_x and local_size_y of worldgen.cs.glsl
+constexpr int kWorldGenGroupSize = 16;
+
+// Stats reductions in flight. A reduction is skipped rather than waited for when all are.
+constexpr uint32_t kStatsSlots = 3;
+
+// Rows read back per band when saving a snapshot, so one band can be written to disk while the
+// next is read back.
+constexpr size_t kSnapshotBandBytes = 8 * 1024 * 1024;
+
+// Most modifications applied in one batch. The rest are applied on the following batches.
+constexpr size_t kMaxModifications = 10000;
+
+// Jobs the sim thread may fall behind by before Simulate drops ticks instead of queuing more.
+constexpr uint64_t kMaxPendingSimJobs = 2;
+
+// Width in chunks of the ring around the window of resident chunks that is kept prefetched.
+constexpr int kPrefetchChunks = 1;
+
+uint64_t ChunkKey(glm::ivec2 pos) {
+  return static_cast<uint64_t>(static_cast<uint32_t>(pos.x)) << 32 | static_cast<uint32_t>(pos.y);
+}
+
+}  // namespace
 
 struct SandSimImpl {
-  SandSimImpl(const glm::ivec2& dims, const glm::ivec2& work_group_size)
-      : dims(dims), work_group_size(work_group_size) {}
+  explicit SandSimImpl(const SandSimCreateInfo& create_info)
+      : dims(create_info.dims),
+        work_group_size(create_info.work_group_size),
+        work_group_size_input(create_info.work_group_size),
+        backend(create_info.backend),
+        rules(create_info.rules),
+        kernel(create_info.kernel),
+        cell_format(create_info.cell_format),
+        cpu_kernel(create_info.cpu_kernel),
+        headless(create_info.headless),
+        use_sim_thread(create_info.sim_thread),
+        num_threads(create_info.num_threads ? create_info.num_threads
+                                            : std::thread::hardware_concurrency()),
+        num_chunks(NumChunks(create_info.dims)),
+        stats_enabled(!create_info.headless) {}
+  ~SandSimImpl() {
+    for (GLsync fence : stats_fences) {
+      if (fence) glDeleteSync(fence);
+    }
+  }
   glm::ivec2 dims;
   glm::ivec2 work_group_size;
+  // edited in OnImGui until applied, and reset to the size in use whenever it changes or reverts
+  glm::ivec2 work_group_size_input;
+  SimBackend backend;
+  SimRules rules;
+  KernelVariant kernel;
+  CellFormat cell_format;
+  CpuKernel cpu_kernel;
+  // headless CPU sims never touch GL
+  bool headless;
+  bool use_sim_thread;
+  uint32_t num_threads;
   gl::Texture curr_tex;
   gl::Texture prev_tex;
+  // only created once the CPU backend is selected
+  std::unique_ptr<CpuSim> cpu_sim;
+  // steps cpu_sim when use_sim_thread is set, declared after it so it stops first
+  std::unique_ptr<SimThread> sim_thread;
+
+  void CreateCpuSim() {
+    cpu_sim = std::make_unique<CpuSim>(dims, num_threads, cpu_kernel, rules);
+    if (use_sim_thread) sim_thread = std::make_unique<SimThread>(*cpu_sim);
+  }
+
+  // Waits for the sim thread, after which cpu_sim may be used directly until the next job.
+  void SyncCpuSim() const {
+    if (sim_thread) sim_thread->Sync();
+  }
+
+  glm::ivec2 num_chunks;
+  // work groups needed to cover one chunk, in cells for demo and in blocks for margolus
+  glm::ivec2 groups_per_chunk{};
+  // GpuChunk per chunk
+  gl::Buffer chunk_buffer;
+  // indirect dispatch args followed by the indices of awake chunks
+  gl::Buffer active_chunk_buffer;
+
+  // Wakes every chunk for the next GPU tick, needed whenever the textures are written directly.
+  void ResetGpuChunks() const {
+    std::vector<GpuChunk> chunks = AwakeGpuChunks(dims, rules);
+    glNamedBufferSubData(chunk_buffer.Id(), 0, chunks.size() * sizeof(GpuChunk), chunks.data());
+  }
+
+  [[nodiscard]] GLenum GlCellFormat() const {
+    return cell_format == CellFormat::kR8ui ? GL_R8UI : GL_R32UI;
+  }
+
+  [[nodiscard]] bool UsesGl() const { return !(headless && backend == SimBackend::kCpu); }
+
+  // Adds every kernel. The defines that vary at runtime select permutations instead, see
+  // UpdateKernelDefines.
+  void LoadKernels() {
+    AddSimKernels();
+    gl::ShaderDefines defines{{"CHUNK_SIZE", std::to_string(kChunkSize)}};
+    std::ranges::copy(MaterialDefines(), std::back_inserter(defines));
+    gl::ShaderManager::Get().AddShader(
+        "stats", {{GET_SHADER_PATH("stats.cs.glsl"), gl::ShaderType::kCompute, defines}});
+    gl::ShaderManager::Get().AddShader(
+        "worldgen", {{GET_SHADER_PATH("worldgen.cs.glsl"), gl::ShaderType::kCompute, defines}});
+    format_defines = gl::DefineSet(gl::ShaderDefines{{"CELL_FORMAT", CellFormatDefine()}});
+    UpdateKernelDefines();
+  }
+
+  [[nodiscard]] const char* CellFormatDefine() const {
+    return cell_format == CellFormat::kR8ui ? "r8ui" : "r32ui";
+  }
+
+  // Selects the kernel permutations for the current work group size. Each compiles on first use
+  // and stays cached, so switching back and forth is free.
+  void UpdateKernelDefines() {
+    gl::ShaderDefines defines{
+        {"WORK_GROUP_X", std::to_string(work_group_size.x)},
+        {"WORK_GROUP_Y", std::to_string(work_group_size.y)},
+        {"CELL_FORMAT", CellFormatDefine()}};
+    kernel_defines = gl::DefineSet(defines);
+    defines.emplace_back("TILED", "1");
+    tiled_kernel_defines = gl::DefineSet(std::move(defines));
+    kernels_dirty = true;
+    work_group_size_input = work_group_size;
+    UpdateGroupsPerChunk();
+  }
+  gl::DefineSet kernel_defines;
+  gl::DefineSet tiled_kernel_defines;
+  // for the kernels that don't depend on the work group size, one permutation is enough
+  gl::DefineSet format_defines;
+
+  // Fetched from the shader manager only when the selection or a program changed.
+  std::optional<gl::Shader> compact_shader;
+  std::optional<gl::Shader> sim_shader;
+  std::optional<gl::Shader> stats_shader;
+  uint64_t kernels_generation{0};
+  bool kernels_dirty{true};
+
+  // What the kernels were last resolved for.
+  struct KernelSelection {
+    SimRules rules;
+    KernelVariant kernel;
+    glm::ivec2 work_group_size;
+  };
+  std::optional<KernelSelection> resolved_selection;
+
+  // A new permutation compiles from the shader on disk, which may be half edited while hot
+  // reloading. If it fails, the previous selection comes back along with its kernels, which are
+  // cached, and this returns false.
+  bool ResolveKernels() {
+    gl::ShaderManager& manager = gl::ShaderManager::Get();
+    if (!kernels_dirty && kernels_generation == manager.Generation()) return true;
+    bool margolus = rules == SimRules::kMargolus;
+    bool tiled = !margolus && kernel == KernelVariant::kTiled;
+    std::optional<gl::Shader> compact = manager.GetShader("chunk_compact");
+    std::optional<gl::Shader> sim = manager.GetShader(
+        margolus ? "margolus" : "demo", tiled ? tiled_kernel_defines : kernel_defines);
+    std::optional<gl::Shader> stats = manager.GetShader("stats", format_defines);
+    if (!compact.has_value() || !sim.has_value() || !stats.has_value()) {
+      EASSERT_MSG(resolved_selection.has_value(), "Failed to compile the sim kernels");
+      spdlog::error("Kernels for {}x{} work groups failed to compile, keeping the previous ones",
+                    work_group_size.x, work_group_size.y);
+      KernelSelection previous = *resolved_selection;
+      SetRules(previous.rules);
+      kernel = previous.kernel;
+      work_group_size = previous.work_group_size;
+      UpdateKernelDefines();
+      ResolveKernels();
+      return false;
+    }
+    compact_shader.emplace(*compact);
+    sim_shader.emplace(*sim);
+    stats_shader.emplace(*stats);
+    resolved_selection = {.rules = rules, .kernel = kernel, .work_group_size = work_group_size};
+    kernels_generation = manager.Generation();
+    kernels_dirty = false;
+    return true;
+  }
+
+  void SetRules(SimRules new_rules) {
+    if (new_rules == rules) return;
+    rules = new_rules;
+    kernels_dirty = true;
+    if (cpu_sim) {
+      SyncCpuSim();
+      cpu_sim->SetRules(rules);
+    }
+    if (!UsesGl()) return;
+    UpdateGroupsPerChunk();
+    ResetGpuChunks();
+  }
+
+  // Modifications, their bins and the SimParams of every pass of a batch. Written straight into
+  // mapped memory, a batch only waits if the GPU is a whole ring behind.
+  gl::RingBuffer upload_ring;
+  // SimParams of each pass start at a multiple of the uniform buffer offset alignment, so each
+  // can be bound on its own
+  uint32_t params_stride{0};
+  uint32_t storage_alignment{1};
+
+  // Uploads everything a batch reads and binds it, except the params, which are bound per pass
+  // starting at the returned offset.
+  uint32_t UploadBatch(uint64_t first_tick, uint32_t num_ticks, int num_passes,
+                       std::span<const Modification> batch) {
+    size_t bins_bytes = 0;
+    if (!batch.empty()) {
+      // chunks own Margolus blocks that reach one cell past them
+      mod_bins.Build(batch, dims, rules == SimRules::kMargolus ? 1 : 0);
+      bins_bytes = mod_bins.data.size() * sizeof(uint32_t);
+    }
+    size_t params_bytes = static_cast<size_t>(num_ticks) * num_passes * params_stride;
+    // with room for aligning each allocation
+    size_t bytes =
+        batch.size_bytes() + bins_bytes + params_bytes + 2 * storage_alignment + params_stride;
+    if (bytes > upload_ring.RegionSize()) {
+      size_t region_size = std::max<size_t>(bytes, 2 * upload_ring.RegionSize());
+      upload_ring.Init(static_cast<uint32_t>(region_size));
+    }
+    upload_ring.BeginRegion();
+
+    if (!batch.empty()) {
+      auto mods_size = static_cast<uint32_t>(batch.size_bytes());
+      uint32_t mods_offset = upload_ring.Allocate(mods_size, storage_alignment).value();
+      std::memcpy(upload_ring.Data(mods_offset), batch.data(), mods_size);
+      upload_ring.GetBuffer().BindRange(GL_SHADER_STORAGE_BUFFER, 0, mods_offset, mods_size);
+      auto bins_size = static_cast<uint32_t>(bins_bytes);
+      uint32_t bins_offset = upload_ring.Allocate(bins_size, storage_alignment).value();
+      std::memcpy(upload_ring.Data(bins_offset), mod_bins.data.data(), bins_size);
+      upload_ring.GetBuffer().BindRange(GL_SHADER_STORAGE_BUFFER, 3, bins_offset, bins_size);
+    }
+
+    bool margolus = rules == SimRules::kMargolus;
+    auto modification_count = static_cast<int>(batch.size());
+    uint32_t params_offset =
+        upload_ring.Allocate(static_cast<uint32_t>(params_bytes), params_stride).value();
+    std::byte* params_data = upload_ring.Data(params_offset);
+    for (uint32_t i = 0; i < num_ticks; i++) {
+      for (int pass = 0; pass < num_passes; pass++) {
+        uint64_t tick = first_tick + i;
+        SimParams params{
+            .grid_size_x = dims.x,
+            .grid_size_y = dims.y,
+            .num_chunks_x = num_chunks.x,
+            .num_chunks_y = num_chunks.y,
+            .groups_per_chunk_x = groups_per_chunk.x,
+            .modification_count = i == 0 && pass == 0 ? modification_count : 0,
+            .block_offset = margolus ? pass : -1,
+            .seed = static_cast<uint32_t>(tick * kMargolusPasses + pass),
+            .tick = static_cast<uint32_t>(tick),
+            .num_worlds = 1,
+        };
+        std::memcpy(params_data, &params, sizeof(params));
+        params_data += params_stride;
+      }
+    }
+    return params_offset;
+  }
+
+  // Sets groups_per_chunk for the current rules and work group size, and the indirect dispatch
+  // once it exists.
+  void UpdateGroupsPerChunk() {
+    groups_per_chunk = GroupsPerChunk(rules, work_group_size);
+    if (active_chunk_buffer.Id() == 0) return;
+    uint32_t groups = groups_per_chunk.x * groups_per_chunk.y;
+    // the y group count of the indirect dispatch
+    glNamedBufferSubData(active_chunk_buffer.Id(), sizeof(uint32_t), sizeof(uint32_t), &groups);
+  }
 
   std::vector<Modification> modifications;
-  gl::Buffer mod_buffer;
+  ModificationBins mod_bins;
   ModificationShape mod_shape{ModificationShape::kCircle};
   float mod_radius{10};
+  MaterialType mod_material{MaterialType::kSand};
+
+  uint64_t tick{0};
+  // Modifications applied and grids replaced so far. Cells are only conserved between stats
+  // samples with the same count.
+  uint64_t edit_count{0};
+  InputRecorder recorder;
+  std::optional<InputReplay> replay;
+  // Two bands of snapshot readback, persistently mapped. Created on the first GPU save.
+  gl::Buffer snapshot_pbo;
+  const std::byte* snapshot_pbo_data{nullptr};
+  int snapshot_band_rows{0};
+
+  void InitSnapshotPbo() {
+    size_t row_bytes = static_cast<size_t>(dims.x) * sizeof(uint32_t);
+    snapshot_band_rows =
+        std::clamp(static_cast<int>(kSnapshotBandBytes / row_bytes), 1, dims.y);
+    auto size = static_cast<uint32_t>(2 * snapshot_band_rows * row_bytes);
+    GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    snapshot_pbo.Init(size, flags | GL_CLIENT_STORAGE_BIT);
+    snapshot_pbo_data = static_cast<const std::byte*>(snapshot_pbo.MapRange(0, size, flags));
+  }
+
+  // Created on the first generated board that isn't a uniform fill.
+  gl::Buffer worldgen_params_buffer;
+  // Fetched on the first such board, apart from the sim kernels so picking a work group size
+  // doesn't compile it.
+  std::optional<gl::Shader> worldgen_shader;
+  uint64_t worldgen_generation{0};
+
+  bool ResolveWorldGenShader() {
+    gl::ShaderManager& manager = gl::ShaderManager::Get();
+    if (worldgen_shader.has_value() && worldgen_generation == manager.Generation()) return true;
+    std::optional<gl::Shader> shader = manager.GetShader("worldgen", format_defines);
+    if (!shader.has_value()) {
+      spdlog::error("Failed to compile the world gen shader");
+      return false;
+    }
+    worldgen_shader.emplace(*shader);
+    worldgen_generation = manager.Generation();
+    return true;
+  }
+
+  // Writes the board of desc into both textures. Uniform fills are a clear, everything else one
+  // dispatch of worldgen.cs.glsl. Returns false, leaving the board as it was, if that doesn't
+  // compile.
+  bool GenerateOnGpu(const WorldGenDesc& desc) {
+    if (desc.kind == WorldGenKind::kFill) {
+      uint32_t cell = CellData::Pack(desc.material, 0);
+      for (const gl::Texture* tex : {&prev_tex, &curr_tex}) {
+        glClearTexImage(tex->Id(), 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &cell);
+      }
+      return true;
+    }
+    if (!ResolveWorldGenShader()) return false;
+    EASSERT_MSG(desc.layers.size() <= kMaxWorldGenLayers, "Too many world gen layers");
+    EASSERT_MSG(desc.feature_size > 0 && desc.amplitude >= 0, "Invalid terrain shape");
+    GpuWorldGenParams params{
+        .kind = static_cast<uint32_t>(desc.kind),
+        .material = static_cast<uint32_t>(desc.material),
+        .seed = desc.seed,
+        .density = desc.density,
+        .base_height = desc.base_height,
+        .amplitude = desc.amplitude,
+        .feature_size = desc.feature_size,
+        .fluid = static_cast<uint32_t>(desc.fluid),
+        .fluid_level = desc.fluid_level,
+        .num_layers = static_cast<int32_t>(desc.layers.size()),
+        .padding = {},
+        .layers = {},
+    };
+    for (size_t i = 0; i < desc.layers.size(); i++) {
+      const WorldGenLayer& layer = desc.layers[i];
+      params.layers[i] = {static_cast<int>(layer.material), layer.y_begin, layer.y_end, 0};
+    }
+    if (worldgen_params_buffer.Id() == 0) {
+      worldgen_params_buffer.Init(sizeof(params), GL_DYNAMIC_STORAGE_BIT);
+    }
+    glNamedBufferSubData(worldgen_params_buffer.Id(), 0, sizeof(params), &params);
+    worldgen_params_buffer.BindBase(GL_UNIFORM_BUFFER, 1);
+    worldgen_shader->Bind();
+    glBindImageTexture(0, prev_tex.Id(), 0, GL_FALSE, 0, GL_WRITE_ONLY, GlCellFormat());
+    glBindImageTexture(1, curr_tex.Id(), 0, GL_FALSE, 0, GL_WRITE_ONLY, GlCellFormat());
+    glDispatchCompute((dims.x + kWorldGenGroupSize - 1) / kWorldGenGroupSize,
+                      (dims.y + kWorldGenGroupSize - 1) / kWorldGenGroupSize, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT |
+                    GL_TEXTURE_FETCH_BARRIER_BIT);
+    return true;
+  }
+
+  // Per material counts and the cells the last pass changed, reduced on the GPU after Simulate()
+  // into one of kStatsSlots slots of a persistently mapped buffer. Each slot is fenced and read
+  // once its fence has signaled, a frame or two later, so the stats never stall the pipeline.
+  struct StatsSample {
+    GpuStats stats;
+    uint64_t tick;
+    uint64_t edit_count;
+  };
+  bool stats_enabled;
+  gl::Buffer stats_buffer;
+  std::byte* stats_data{nullptr};
+  uint32_t stats_stride{0};
+  uint32_t stats_next_slot{0};
+  std::array<GLsync, kStatsSlots> stats_fences{};
+  // tick and edit_count of the sample in flight in each slot
+  std::array<StatsSample, kStatsSlots> stats_pending{};
+  // the latest sample read back and the one before it
+  std::optional<StatsSample> stats_latest;
+  std::optional<StatsSample> stats_previous;
+
+  void InitStatsBuffer() {
+    stats_stride = (sizeof(GpuStats) + storage_alignment - 1) / storage_alignment *
+                   storage_alignment;
+    uint32_t size = stats_stride * kStatsSlots;
+    GLbitfield flags =
+        GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    stats_buffer.Init(size, flags | GL_CLIENT_STORAGE_BIT);
+    stats_data = static_cast<std::byte*>(stats_buffer.MapRange(0, size, flags));
+  }
+
+  // Queues a reduction of the latest grid, unless every slot is still in flight.
+  void DispatchStats() {
+    if (stats_data) PollStats();
+    uint32_t slot = stats_next_slot;
+    if (stats_fences[slot]) return;
+    if (!stats_data) InitStatsBuffer();
+    gl::GpuScope gpu_scope("stats");
+    uint32_t offset = slot * stats_stride;
+    GpuStats cleared{};
+    std::memcpy(stats_data + offset, &cleared, sizeof(cleared));
+    stats_buffer.BindRange(GL_SHADER_STORAGE_BUFFER, 4, offset, sizeof(GpuStats));
+    ResolveKernels();
+    stats_shader->Bind();
+    // the GPU path swaps after dispatching, so the latest output is in prev_tex
+    glBindImageTexture(0, prev_tex.Id(), 0, GL_FALSE, 0, GL_READ_ONLY, GlCellFormat());
+    glBindImageTexture(1, curr_tex.Id(), 0, GL_FALSE, 0, GL_READ_ONLY, GlCellFormat());
+    glDispatchCompute((dims.x + kStatsGroupSize - 1) / kStatsGroupSize,
+                      (dims.y + kStatsGroupSize - 1) / kStatsGroupSize, 1);
+    glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+    stats_fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    stats_pending[slot].tick = tick;
+    stats_pending[slot].edit_count = edit_count;
+    stats_next_slot = (slot + 1) % kStatsSlots;
+  }
+
+  // Reads back every finished sample without waiting for the rest.
+  void PollStats() {
+    // slots finish in the order they were dispatched, starting at the oldest
+    for (uint32_t i = 0; i < kStatsSlots; i++) {
+      uint32_t slot = (stats_next_slot + i) % kStatsSlots;
+      GLsync& fence = stats_fences[slot];
+      if (!fence) continue;
+      GLenum status = glClientWaitSync(fence, 0, 0);
+      if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break;
+      glDeleteSync(fence);
+      fence = nullptr;
+      StatsSample& sample = stats_pending[slot];
+      std::memcpy(&sample.stats, stats_data + slot * stats_stride, sizeof(GpuStats));
+      stats_previous = stats_latest;
+      stats_latest = sample;
+    }
+  }
+
+  // With a world_dir, the grid is the window of resident chunks of an unbounded world, with
+  // grid chunk (0, 0) at world chunk world_origin. Chunks leaving the window are written to
+  // chunk_store and the ring of kPrefetchChunks around it is read into staged_chunks ahead of
+  // time. Memory is bounded by dims and that ring, however large the world grows. Chunks never
+  // saved come from world_gen, in world cells, so the window at the origin starts out as the
+  // board a fixed one would.
+  std::unique_ptr<ChunkStore> chunk_store;
+  glm::ivec2 world_origin{0};
+  WorldGenDesc world_gen;
+  // nullopt for chunks never saved
+  std::unordered_map<uint64_t, std::optional<ChunkCells>> staged_chunks;
+  // loads queued but not taken yet
+  std::unordered_set<uint64_t> requested_chunks;
+
+  [[nodiscard]] bool InWindow(glm::ivec2 local) const {
+    return local.x >= 0 && local.y >= 0 && local.x < num_chunks.x && local.y < num_chunks.y;
+  }
+
+  [[nodiscard]] bool InPrefetchRing(glm::ivec2 world_pos) const {
+    glm::ivec2 local = world_pos - world_origin;
+    return !InWindow(local) && local.x >= -kPrefetchChunks && local.y >= -kPrefetchChunks &&
+           local.x < num_chunks.x + kPrefetchChunks && local.y < num_chunks.y + kPrefetchChunks;
+  }
+
+  [[nodiscard]] ChunkCells ExtractChunk(std::span<const uint32_t> grid, glm::ivec2 local) const {
+    ChunkCells cells(static_cast<size_t>(kChunkSize) * kChunkSize);
+    for (int y = 0; y < kChunkSize; y++) {
+      size_t row = static_cast<size_t>(local.y * kChunkSize + y) * dims.x + local.x * kChunkSize;
+      std::copy_n(grid.begin() + static_cast<ptrdiff_t>(row), kChunkSize,
+                  cells.begin() + static_cast<ptrdiff_t>(y) * kChunkSize);
+    }
+    return cells;
+  }
+
+  void InsertChunk(std::span<uint32_t> grid, glm::ivec2 local, const ChunkCells& cells) const {
+    for (int y = 0; y < kChunkSize; y++) {
+      size_t row = static_cast<size_t>(local.y * kChunkSize + y) * dims.x + local.x * kChunkSize;
+      std::copy_n(cells.begin() + static_cast<ptrdiff_t>(y) * kChunkSize, kChunkSize,
+                  grid.begin() + static_cast<ptrdiff_t>(row));
+    }
+  }
+
+  // Moves the chunks read so far into staged_chunks. Staged cells are never older than the
+  // store's, since every chunk is saved before it can be staged again.
+  void PollWorld() {
+    for (LoadedChunk& loaded : chunk_store->TakeLoaded()) {
+      uint64_t key = ChunkKey(loaded.pos);
+      requested_chunks.erase(key);
+      staged_chunks.try_emplace(key, std::move(loaded.cells));
+    }
+  }
+
+  // Queues loads for the prefetch ring and drops staged chunks that left it.
+  void PrefetchWorld() {
+    PollWorld();
+    std::erase_if(staged_chunks, [this](const auto& entry) {
+      glm::ivec2 pos{static_cast<int32_t>(entry.first >> 32), static_cast<int32_t>(entry.first)};
+      return !InPrefetchRing(pos);
+    });
+    for (int y = -kPrefetchChunks; y < num_chunks.y + kPrefetchChunks; y++) {
+      for (int x = -kPrefetchChunks; x < num_chunks.x + kPrefetchChunks; x++) {
+        glm::ivec2 pos = world_origin + glm::ivec2{x, y};
+        uint64_t key = ChunkKey(pos);
+        if (!InPrefetchRing(pos) || staged_chunks.contains(key) ||
+            requested_chunks.contains(key)) {
+          continue;
+        }
+        chunk_store->Load(pos);
+        requested_chunks.insert(key);
+      }
+    }
+  }
+
+  // Returns the cells of a chunk, waiting on the store only if it wasn't prefetched. nullopt if it
+  // was never saved.
+  std::optional<ChunkCells> TakeChunk(glm::ivec2 pos) {
+    uint64_t key = ChunkKey(pos);
+    PollWorld();
+    if (!staged_chunks.contains(key)) {
+      if (!requested_chunks.contains(key)) {
+        chunk_store->Load(pos);
+        requested_chunks.insert(key);
+      }
+      chunk_store->WaitIdle();
+      PollWorld();
+    }
+    auto node = staged_chunks.extract(key);
+    EASSERT_MSG(!node.empty(), "Chunk was loaded but not staged");
+    return std::move(node.mapped());
+  }
+
+  // Writes cells over the chunk at local in both textures. Its chunk must be woken after.
+  void UploadChunk(glm::ivec2 local, const ChunkCells& cells) const {
+    for (const gl::Texture* tex : {&prev_tex, &curr_tex}) {
+      glTextureSubImage2D(tex->Id(), 0, local.x * kChunkSize, local.y * kChunkSize, kChunkSize,
+                          kChunkSize, GL_RED_INTEGER, GL_UNSIGNED_INT, cells.data());
+    }
+  }
+
+  // The cells world_gen puts in the chunk at pos, in world chunks.
+  [[nodiscard]] ChunkCells GenerateChunk(glm::ivec2 pos) const {
+    ChunkCells cells;
+    cells.reserve(static_cast<size_t>(kChunkSize) * kChunkSize);
+    for (int y = 0; y < kChunkSize; y++) {
+      for (int x = 0; x < kChunkSize; x++) {
+        cells.emplace_back(WorldGenCell(world_gen, pos * kChunkSize + glm::ivec2{x, y}));
+      }
+    }
+    return cells;
+  }
+
+  ChunkCells TakeOrGenerateChunk(glm::ivec2 pos) {
+    std::optional<ChunkCells> cells = TakeChunk(pos);
+    return cells.has_value() ? std::move(cells.value()) : GenerateChunk(pos);
+  }
+
+  // Moves the window to new_origin without a round trip of the whole grid. Resident chunks are
+  // copied within the textures, only evicted chunks are read back and only entering ones
+  // uploaded. Resident chunks keep their dirty rects, moved along, unless they border an
+  // entering chunk: the window edge no longer walls them off.
+  void ScrollGpu(glm::ivec2 new_origin) {
+    glm::ivec2 delta = new_origin - world_origin;
+    glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+    // the GPU path swaps after dispatching, so the latest grid is in prev_tex
+    for (int y = 0; y < num_chunks.y; y++) {
+      for (int x = 0; x < num_chunks.x; x++) {
+        glm::ivec2 pos = world_origin + glm::ivec2{x, y};
+        if (InWindow(pos - new_origin)) continue;
+        ChunkCells cells(static_cast<size_t>(kChunkSize) * kChunkSize);
+        glGetTextureSubImage(prev_tex.Id(), 0, x * kChunkSize, y * kChunkSize, 0, kChunkSize,
+                             kChunkSize, 1, GL_RED_INTEGER, GL_UNSIGNED_INT,
+                             static_cast<GLsizei>(cells.size() * sizeof(uint32_t)), cells.data());
+        chunk_store->Save(pos, cells);
+        staged_chunks.insert_or_assign(ChunkKey(pos), std::move(cells));
+      }
+    }
+    // the resident chunks are one rect, copied to its new place in curr_tex
+    glm::ivec2 kept_min = glm::max(delta, glm::ivec2{0});
+    glm::ivec2 kept_end = glm::min(num_chunks + delta, num_chunks);
+    if (kept_min.x < kept_end.x && kept_min.y < kept_end.y) {
+      glm::ivec2 src = kept_min * kChunkSize;
+      glm::ivec2 dst = (kept_min - delta) * kChunkSize;
+      glm::ivec2 size = (kept_end - kept_min) * kChunkSize;
+      glCopyImageSubData(prev_tex.Id(), GL_TEXTURE_2D, 0, src.x, src.y, 0, curr_tex.Id(),
+                         GL_TEXTURE_2D, 0, dst.x, dst.y, 0, size.x, size.y, 1);
+    }
+    for (int y = 0; y < num_chunks.y; y++) {
+      for (int x = 0; x < num_chunks.x; x++) {
+        glm::ivec2 pos = new_origin + glm::ivec2{x, y};
+        if (InWindow(pos - world_origin)) continue;
+        ChunkCells cells = TakeOrGenerateChunk(pos);
+        glTextureSubImage2D(curr_tex.Id(), 0, x * kChunkSize, y * kChunkSize, kChunkSize,
+                            kChunkSize, GL_RED_INTEGER, GL_UNSIGNED_INT, cells.data());
+      }
+    }
+    // like SetGrid, both textures hold the new grid
+    glCopyImageSubData(curr_tex.Id(), GL_TEXTURE_2D, 0, 0, 0, 0, prev_tex.Id(), GL_TEXTURE_2D, 0,
+                       0, 0, 0, dims.x, dims.y, 1);
+
+    size_t count = static_cast<size_t>(num_chunks.x) * num_chunks.y;
+    std::vector<GpuChunk> chunks(count);
+    glGetNamedBufferSubData(chunk_buffer.Id(), 0, count * sizeof(GpuChunk), chunks.data());
+    std::vector<GpuChunk> scrolled(count);
+    glm::ivec2 shift = delta * kChunkSize;
+    auto entering = [&](glm::ivec2 local) { return InWindow(local) && !InWindow(local + delta); };
+    for (int y = 0; y < num_chunks.y; y++) {
+      for (int x = 0; x < num_chunks.x; x++) {
+        glm::ivec2 local{x, y};
+        GpuChunk& chunk = scrolled[y * num_chunks.x + x];
+        glm::ivec2 old_local = local + delta;
+        if (InWindow(old_local)) {
+          chunk = chunks[old_local.y * num_chunks.x + old_local.x];
+          for (DirtyRect* rect : {&chunk.rect, &chunk.next_rect, &chunk.later_rect}) {
+            if (rect->Empty()) continue;
+            rect->min = rect->min - shift;
+            rect->max = rect->max - shift;
+          }
+        }
+        bool wake = false;
+        for (int dy = -1; dy <= 1; dy++) {
+          for (int dx = -1; dx <= 1; dx++) wake |= entering(local + glm::ivec2{dx, dy});
+        }
+        if (!wake) continue;
+        // as in AwakeGpuChunks
+        chunk.next_rect = ChunkBounds(local, dims);
+        if (rules == SimRules::kMargolus) chunk.later_rect = chunk.next_rect;
+      }
+    }
+    glNamedBufferSubData(chunk_buffer.Id(), 0, count * sizeof(GpuChunk), scrolled.data());
+    world_origin = new_origin;
+    edit_count++;
+  }
+
+  // Queues loads for the window at world_origin, taken by TakeSavedWindow.
+  void RequestWindow() {
+    for (int y = 0; y < num_chunks.y; y++) {
+      for (int x = 0; x < num_chunks.x; x++) {
+        glm::ivec2 pos = world_origin + glm::ivec2{x, y};
+        chunk_store->Load(pos);
+        requested_chunks.insert(ChunkKey(pos));
+      }
+    }
+  }
+
+  // The chunks of the window that were saved before, at their position in the grid. The others
+  // are left to the generated board.
+  std::vector<std::pair<glm::ivec2, ChunkCells>> TakeSavedWindow() {
+    std::vector<std::pair<glm::ivec2, ChunkCells>> saved;
+    for (int y = 0; y < num_chunks.y; y++) {
+      for (int x = 0; x < num_chunks.x; x++) {
+        std::optional<ChunkCells> cells = TakeChunk(world_origin + glm::ivec2{x, y});
+        if (cells.has_value()) saved.emplace_back(glm::ivec2{x, y}, std::move(cells.value()));
+      }
+    }
+    return saved;
+  }
 };
 
 // defined here due to pimpl
-SandSim::SandSim(const Window& window) : window_(window) {}
+SandSim::SandSim() = default;
+SandSim::SandSim(const Window& window) : window_(&window) {}
 SandSim::~SandSim() = default;
 
-void SandSim::Start(const glm::ivec2& dims, const glm::ivec2& work_group_size) {
-  impl_ = std::make_unique<SandSimImpl>(dims, work_group_size);
-  impl_->mod_buffer.Init(sizeof(Modification) * 10000, GL_DYNAMIC_STORAGE_BIT);
+void SandSim::Start(const SandSimCreateInfo& create_info) {
+  impl_ = std::make_unique<SandSimImpl>(create_info);
+  const glm::ivec2& dims = create_info.dims;
+  impl_->world_gen = create_info.world_gen.value_or(DefaultWorld(dims));
+  // The board is generated in place. A streamed world then writes the chunks it saved before
+  // over it, the window starts at the world origin so the rest is what world_gen puts there.
+  auto load_board = [&] {
+    Generate(impl_->world_gen);
+    if (!impl_->chunk_store) return;
+    std::vector<std::pair<glm::ivec2, ChunkCells>> saved = impl_->TakeSavedWindow();
+    if (!saved.empty() && impl_->backend == SimBackend::kGpu) {
+      for (const auto& [local, cells] : saved) impl_->UploadChunk(local, cells);
+      impl_->ResetGpuChunks();
+    } else if (!saved.empty()) {
+      std::vector<uint32_t> grid = GetGrid();
+      for (const auto& [local, cells] : saved) impl_->InsertChunk(grid, local, cells);
+      SetGrid(grid);
+    }
+    impl_->PrefetchWorld();
+  };
+  if (!create_info.world_dir.empty()) {
+    EASSERT_MSG(dims.x % kChunkSize == 0 && dims.y % kChunkSize == 0,
+                "A streamed world needs dims in whole chunks");
+    impl_->chunk_store = std::make_unique<ChunkStore>(create_info.world_dir);
+    // read in the background while GL is set up
+    impl_->RequestWindow();
+  }
+  if (impl_->backend == SimBackend::kCpu) impl_->CreateCpuSim();
+  if (!impl_->UsesGl()) {
+    load_board();
+    return;
+  }
+
+  impl_->LoadKernels();
+  GLint params_alignment = 1;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &params_alignment);
+  impl_->params_stride =
+      (sizeof(SimParams) + params_alignment - 1) / params_alignment * params_alignment;
+  GLint storage_alignment = 1;
+  glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storage_alignment);
+  impl_->storage_alignment = storage_alignment;
+  impl_->upload_ring.Init(sizeof(Modification) * kMaxModifications);
+
+  uint32_t num_chunks = impl_->num_chunks.x * impl_->num_chunks.y;
+  impl_->chunk_buffer.Init(sizeof(GpuChunk) * num_chunks, GL_DYNAMIC_STORAGE_BIT);
+  std::vector<uint32_t> active_chunk_data(3 + num_chunks, 0);
+  active_chunk_data[1] = impl_->groups_per_chunk.x * impl_->groups_per_chunk.y;
+  active_chunk_data[2] = 1;
+  impl_->active_chunk_buffer.Init(sizeof(uint32_t) * active_chunk_data.size(),
+                                  GL_DYNAMIC_STORAGE_BIT, active_chunk_data.data());
   gl::Tex2DCreateInfoEmpty params{.dims = {dims.x, dims.y},
                                   .wrap_s = GL_CLAMP_TO_EDGE,
                                   .wrap_t = GL_CLAMP_TO_EDGE,
-                                  .internal_format = GL_R32UI,
+                                  .internal_format = impl_->GlCellFormat(),
                                   .min_filter = GL_LINEAR,
                                   .mag_filter = GL_LINEAR};
   impl_->curr_tex.Load(params);
   impl_->prev_tex.Load(params);
-  int height = 1;
-  std::vector<uint32_t> data;
-  std::vector<uint32_t> data2;
-  data.reserve(static_cast<uint32_t>(dims.x * dims.y));
-  data2.reserve(static_cast<uint32_t>(dims.x * dims.y));
-  for (int i = 0; i < dims.x * (dims.y - height - 1); i++) {
-    data.emplace_back(CellData::Pack(MaterialType::kNone, 0));
-    data2.emplace_back(CellData::Pack(MaterialType::kNone, 0));
-  }
-  for (int i = 0; i < dims.x * height; i++) {
-    data.emplace_back(CellData::Pack(MaterialType::kSand, 0));
-    data2.emplace_back(CellData::Pack(MaterialType::kNone, 0));
-  }
-  for (int i = 0; i < dims.x * height; i++) {
-    data.emplace_back(CellData::Pack(MaterialType::kNone, 0));
-    data2.emplace_back(CellData::Pack(MaterialType::kNone, 0));
-  }
-  glTextureSubImage2D(impl_->curr_tex.Id(), 0, 0, 0, dims.x, dims.y, GL_RED_INTEGER,
-                      GL_UNSIGNED_INT, data2.data());
-  glTextureSubImage2D(impl_->prev_tex.Id(), 0, 0, 0, dims.x, dims.y, GL_RED_INTEGER,
-                      GL_UNSIGNED_INT, data.data());
+  load_board();
 }
 
 void SandSim::Update() {
+  if (impl_->chunk_store) impl_->PollWorld();
+  if (!window_ || impl_->replay.has_value()) return;
   if (Input::IsMouseButtonPressed(SDL_BUTTON_LEFT)) {
-    auto pos = window_.GetMousePosition();
-    auto win_dims = window_.GetWindowSize();
+    auto pos = window_->GetMousePosition();
+    auto win_dims = window_->GetWindowSize();
     pos.y = win_dims.y - pos.y;
     // screen 1600,900
     glm::ivec2 true_pos = pos * impl_->dims / win_dims;
 
-    impl_->modifications.emplace_back(Modification{.x = true_pos.x,
-                                                   .y = true_pos.y,
-                                                   .radius = impl_->mod_radius,
-                                                   .shape = impl_->mod_shape,
-                                                   .cell = 1});
+    impl_->modifications.emplace_back(
+        Modification{.x = true_pos.x,
+                     .y = true_pos.y,
+                     .radius = impl_->mod_radius,
+                     .shape = impl_->mod_shape,
+                     .cell = static_cast<int>(impl_->mod_material)});
   }
 }
-void SandSim::Simulate() const {
-  gl::Shader compute_shader = gl::ShaderManager::Get().GetShader("demo").value();
-  compute_shader.Bind();
-  if (!impl_->modifications.empty()) {
-    impl_->mod_buffer.SubDataStart(sizeof(Modification) * impl_->modifications.size(),
-                                   impl_->modifications.data());
+void SandSim::Simulate(uint32_t num_ticks) const {
+  bool threaded = impl_->backend == SimBackend::kCpu && impl_->sim_thread;
+  // The sim thread runs at its own pace. Ticks it can't keep up with are dropped rather than
+  // queued, so edits and drawing never wait on it. Edits stay queued for the next job.
+  if (threaded && impl_->sim_thread->NumPending() >= kMaxPendingSimJobs) num_ticks = 0;
+  if (!impl_->replay.has_value()) {
+    SimulateTicks(num_ticks);
+  } else {
+    // split the batch so every logged modification lands on its recorded tick
+    for (uint32_t remaining = num_ticks; remaining > 0;) {
+      impl_->replay->Take(impl_->tick, impl_->modifications);
+      uint64_t until_next = impl_->replay->NextTick() - impl_->tick;
+      auto ticks = static_cast<uint32_t>(std::min<uint64_t>(remaining, until_next));
+      SimulateTicks(ticks);
+      remaining -= ticks;
+    }
+    if (impl_->replay->Done() && impl_->modifications.empty()) {
+      spdlog::info("Replay finished at tick {}", impl_->tick);
+      impl_->replay.reset();
+    }
   }
-  compute_shader.SetInt("modification_count", impl_->modifications.size());
-  impl_->modifications.clear();
+  if (num_ticks > 0 && impl_->backend == SimBackend::kGpu && impl_->stats_enabled) {
+    impl_->DispatchStats();
+  }
+  if (threaded && !impl_->headless && impl_->sim_thread->TakeFrame()) {
+    const std::vector<uint32_t>& grid = impl_->sim_thread->GetFrame().grid;
+    glTextureSubImage2D(impl_->curr_tex.Id(), 0, 0, 0, impl_->dims.x, impl_->dims.y,
+                        GL_RED_INTEGER, GL_UNSIGNED_INT, grid.data());
+  }
+}
+
+void SandSim::SimulateTicks(uint32_t num_ticks) const {
+  if (num_ticks == 0) return;
+  uint64_t first_tick = impl_->tick;
+  impl_->tick += num_ticks;
+  if (impl_->backend == SimBackend::kCpu) {
+    impl_->recorder.Record(first_tick, impl_->modifications);
+    impl_->edit_count += impl_->modifications.size();
+    if (impl_->sim_thread) {
+      impl_->sim_thread->Submit({.first_tick = first_tick,
+                                 .num_ticks = num_ticks,
+                                 .modifications = std::move(impl_->modifications)});
+      impl_->modifications.clear();
+      return;
+    }
+    impl_->cpu_sim->Step(impl_->modifications, first_tick);
+    impl_->modifications.clear();
+    for (uint32_t i = 1; i < num_ticks; i++) impl_->cpu_sim->Step({}, first_tick + i);
+    if (!impl_->headless) {
+      glTextureSubImage2D(impl_->curr_tex.Id(), 0, 0, 0, impl_->dims.x, impl_->dims.y,
+                          GL_RED_INTEGER, GL_UNSIGNED_INT, impl_->cpu_sim->GetGrid().data());
+    }
+    return;
+  }
+  gl::GpuScope gpu_scope("simulate");
+  size_t mod_count = std::min(impl_->modifications.size(), kMaxModifications);
+  std::span<const Modification> batch(impl_->modifications.data(), mod_count);
+  if (mod_count > 0) impl_->recorder.Record(first_tick, batch);
+  impl_->edit_count += mod_count;
+  // before anything depends on the rules or work group size, which a failed compile reverts
+  impl_->ResolveKernels();
+  int num_passes = impl_->rules == SimRules::kMargolus ? kMargolusPasses : 1;
+  // Without modifications the mod bindings are left as they are, the kernels don't read them.
+  uint32_t params_offset = impl_->UploadBatch(first_tick, num_ticks, num_passes, batch);
+  impl_->modifications.erase(impl_->modifications.begin(),
+                             impl_->modifications.begin() + static_cast<ptrdiff_t>(mod_count));
+  impl_->chunk_buffer.BindBase(GL_SHADER_STORAGE_BUFFER, 1);
+  impl_->active_chunk_buffer.BindBase(GL_SHADER_STORAGE_BUFFER, 2);
+  impl_->active_chunk_buffer.Bind(GL_DISPATCH_INDIRECT_BUFFER);
+
+  const gl::Shader& compact_shader = impl_->compact_shader.value();
+  const gl::Shader& sim_shader = impl_->sim_shader.value();
 
-  compute_shader.SetInt("grid_size_x", impl_->dims.x);
-  compute_shader.SetInt("grid_size_y", impl_->dims.y);
+  // Every pass is queued back to back, ordered only by barriers, and reads its parameters from
+  // its own slice of the upload ring. Modifications apply on the first pass of the batch.
+  int num_chunks = impl_->num_chunks.x * impl_->num_chunks.y;
+  for (uint32_t i = 0; i < num_ticks; i++) {
+    for (int pass = 0; pass < num_passes; pass++) {
+      impl_->upload_ring.GetBuffer().BindRange(GL_UNIFORM_BUFFER, 0, params_offset,
+                                               sizeof(SimParams));
+      params_offset += impl_->params_stride;
+      // build the list of awake chunks, which sets the group count of the indirect dispatch
+      uint32_t zero = 0;
+      glClearNamedBufferSubData(impl_->active_chunk_buffer.Id(), GL_R32UI, 0, sizeof(uint32_t),
+                                GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+      compact_shader.Bind();
+      glDispatchCompute((num_chunks + kCompactGroupSize - 1) / kCompactGroupSize, 1, 1);
+      glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
 
-  glBindImageTexture(0, impl_->prev_tex.Id(), 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32UI);
-  glBindImageTexture(1, impl_->curr_tex.Id(), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32UI);
-  impl_->mod_buffer.BindBase(GL_SHADER_STORAGE_BUFFER, 0);
-  glDispatchCompute((impl_->dims.x + impl_->work_group_size.x - 1) / impl_->work_group_size.x,
-                    (impl_->dims.y + impl_->work_group_size.y - 1) / impl_->work_group_size.y, 1);
-  glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-  std::swap(impl_->curr_tex, impl_->prev_tex);
+      sim_shader.Bind();
+      glBindImageTexture(0, impl_->prev_tex.Id(), 0, GL_FALSE, 0, GL_READ_ONLY,
+                         impl_->GlCellFormat());
+      glBindImageTexture(1, impl_->curr_tex.Id(), 0, GL_FALSE, 0, GL_WRITE_ONLY,
+                         impl_->GlCellFormat());
+      glDispatchComputeIndirect(0);
+      glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT |
+                      GL_BUFFER_UPDATE_BARRIER_BIT);
+      std::swap(impl_->curr_tex, impl_->prev_tex);
+    }
+  }
+  impl_->upload_ring.EndRegion();
 }
 
 const gl::Texture& SandSim::GetCurrTex() const { return impl_->curr_tex; }
 
+SimBackend SandSim::GetBackend() const { return impl_->backend; }
+
+std::vector<uint32_t> SandSim::GetGrid() const {
+  if (impl_->backend == SimBackend::kCpu) {
+    impl_->SyncCpuSim();
+    return impl_->cpu_sim->GetGrid();
+  }
+  std::vector<uint32_t> grid(static_cast<size_t>(impl_->dims.x) * impl_->dims.y);
+  // the GPU path swaps after dispatching, so the latest output is in prev_tex
+  glGetTextureImage(impl_->prev_tex.Id(), 0, GL_RED_INTEGER, GL_UNSIGNED_INT,
+                    grid.size() * sizeof(uint32_t), grid.data());
+  return grid;
+}
+
+void SandSim::SetGrid(std::span<const uint32_t> grid) {
+  EASSERT_MSG(grid.size() == static_cast<size_t>(impl_->dims.x) * impl_->dims.y,
+              "Grid size mismatch");
+  impl_->edit_count++;
+  if (impl_->backend == SimBackend::kCpu) {
+    impl_->SyncCpuSim();
+    impl_->cpu_sim->SetGrid(grid);
+    // drops the last frame of the replaced grid if it wasn't drawn yet
+    if (impl_->sim_thread) impl_->sim_thread->TakeFrame();
+  }
+  if (!impl_->UsesGl()) return;
+  // GL narrows the uint32_t cells itself when the textures are R8UI
+  for (const gl::Texture* tex : {&impl_->prev_tex, &impl_->curr_tex}) {
+    glTextureSubImage2D(tex->Id(), 0, 0, 0, impl_->dims.x, impl_->dims.y, GL_RED_INTEGER,
+                        GL_UNSIGNED_INT, grid.data());
+  }
+  impl_->ResetGpuChunks();
+}
+
+void SandSim::Generate(const WorldGenDesc& desc) {
+  // the CPU backend simulates a host grid anyway, and it is the fallback for a broken shader
+  if (impl_->backend == SimBackend::kCpu || !impl_->GenerateOnGpu(desc)) {
+    SetGrid(GenerateWorld(desc, impl_->dims));
+    return;
+  }
+  impl_->edit_count++;
+  impl_->ResetGpuChunks();
+}
+
+void SandSim::AddModification(const Modification& modification) {
+  impl_->modifications.emplace_back(modification);
+}
+
+void SandSim::SetBackend(SimBackend backend) {
+  if (backend == impl_->backend) return;
+  EASSERT_MSG(!impl_->headless, "Headless sims can't switch backends");
+  std::vector<uint32_t> grid = GetGrid();
+  impl_->backend = backend;
+  if (backend == SimBackend::kCpu && !impl_->cpu_sim) impl_->CreateCpuSim();
+  SetGrid(grid);
+}
+
+glm::ivec2 SandSim::GetDims() const { return impl_->dims; }
+
+uint64_t SandSim::GetTick() const { return impl_->tick; }
+
+bool SandSim::SaveSnapshot(const std::string& path) const {
+  const glm::ivec2& dims = impl_->dims;
+  SnapshotWriter writer;
+  if (!writer.Open(path, {.width = dims.x, .height = dims.y, .tick = impl_->tick})) {
+    return false;
+  }
+  if (impl_->backend == SimBackend::kCpu) {
+    impl_->SyncCpuSim();
+    const std::vector<uint32_t>& grid = impl_->cpu_sim->GetGrid();
+    writer.Write(grid.data(), grid.size() * sizeof(uint32_t));
+    return writer.Close();
+  }
+
+  // Streams the texture through the mapped PBO in bands, reading the next band back while the
+  // previous one is written to disk.
+  if (!impl_->snapshot_pbo_data) impl_->InitSnapshotPbo();
+  const int band_rows = impl_->snapshot_band_rows;
+  const size_t row_bytes = static_cast<size_t>(dims.x) * sizeof(uint32_t);
+  const int num_bands = (dims.y + band_rows - 1) / band_rows;
+  std::array<GLsync, 2> fences{};
+  auto band_offset = [&](int band) { return (band % 2) * band_rows * row_bytes; };
+  auto band_bytes = [&](int band) {
+    return std::min(band_rows, dims.y - band * band_rows) * row_bytes;
+  };
+  auto read_band = [&](int band) {
+    // with a pack buffer bound, the pixels pointer is an offset into it
+    glGetTextureSubImage(impl_->prev_tex.Id(), 0, 0, band * band_rows, 0, dims.x,
+                         static_cast<GLsizei>(band_bytes(band) / row_bytes), 1, GL_RED_INTEGER,
+                         GL_UNSIGNED_INT, static_cast<GLsizei>(band_bytes(band)),
+                         reinterpret_cast<void*>(band_offset(band)));
+    fences[band % 2] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  };
+  impl_->snapshot_pbo.Bind(GL_PIXEL_PACK_BUFFER);
+  read_band(0);
+  for (int band = 0; band < num_bands; band++) {
+    if (band + 1 < num_bands) read_band(band + 1);
+    glClientWaitSync(fences[band % 2], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+    glDeleteSync(fences[band % 2]);
+    writer.Write(impl_->snapshot_pbo_data + band_offset(band), band_bytes(band));
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  return writer.Close();
+}
+
+bool SandSim::StartRecording(const std::string& path) {
+  StopRecording();
+  return impl_->recorder.Open(path, impl_->dims);
+}
+
+void SandSim::StopRecording() {
+  if (impl_->recorder.IsOpen()) impl_->recorder.Close();
+}
+
+bool SandSim::StartReplay(const std::string& path) {
+  std::optional<InputReplay> replay = InputReplay::Open(path);
+  if (!replay.has_value()) return false;
+  if (replay->Dims() != impl_->dims) {
+    spdlog::error("Input log {} was recorded at {}x{}, the sim is {}x{}", path, replay->Dims().x,
+                  replay->Dims().y, impl_->dims.x, impl_->dims.y);
+    return false;
+  }
+  impl_->replay = std::move(replay);
+  impl_->modifications.clear();
+  return true;
+}
+
+void SandSim::StopReplay() { impl_->replay.reset(); }
+
+void SandSim::ScrollWorld(glm::ivec2 delta) {
+  if (!impl_->chunk_store || delta == glm::ivec2{0}) return;
+  glm::ivec2 old_origin = impl_->world_origin;
+  glm::ivec2 new_origin = old_origin + delta;
+  if (impl_->backend == SimBackend::kGpu) {
+    impl_->ScrollGpu(new_origin);
+    impl_->PrefetchWorld();
+    return;
+  }
+  // the CPU backend's grid is on the host anyway
+  std::vector<uint32_t> grid = GetGrid();
+  std::vector<uint32_t> scrolled(grid.size());
+  // chunks that stay resident move within the grid, the rest are evicted
+  for (int y = 0; y < impl_->num_chunks.y; y++) {
+    for (int x = 0; x < impl_->num_chunks.x; x++) {
+      glm::ivec2 pos = old_origin + glm::ivec2{x, y};
+      ChunkCells cells = impl_->ExtractChunk(grid, {x, y});
+      if (impl_->InWindow(pos - new_origin)) {
+        impl_->InsertChunk(scrolled, pos - new_origin, cells);
+      } else {
+        impl_->chunk_store->Save(pos, cells);
+        impl_->staged_chunks.insert_or_assign(ChunkKey(pos), std::move(cells));
+      }
+    }
+  }
+  for (int y = 0; y < impl_->num_chunks.y; y++) {
+    for (int x = 0; x < impl_->num_chunks.x; x++) {
+      glm::ivec2 pos = new_origin + glm::ivec2{x, y};
+      if (impl_->InWindow(pos - old_origin)) continue;
+      impl_->InsertChunk(scrolled, {x, y}, impl_->TakeOrGenerateChunk(pos));
+    }
+  }
+  impl_->world_origin = new_origin;
+  SetGrid(scrolled);
+  impl_->PrefetchWorld();
+}
+
+void SandSim::SaveWorld() const {
+  if (!impl_->chunk_store) return;
+  std::vector<uint32_t> grid = GetGrid();
+  for (int y = 0; y < impl_->num_chunks.y; y++) {
+    for (int x = 0; x < impl_->num_chunks.x; x++) {
+      impl_->chunk_store->Save(impl_->world_origin + glm::ivec2{x, y},
+                               impl_->ExtractChunk(grid, {x, y}));
+    }
+  }
+}
+
+bool SandSim::IsReplaying() const { return impl_->replay.has_value(); }
+
+bool SandSim::LoadSnapshot(const std::string& path) {
+  std::optional<MappedSnapshot> snapshot = MappedSnapshot::Open(path);
+  if (!snapshot.has_value()) return false;
+  if (snapshot->Dims() != impl_->dims) {
+    spdlog::error("Snapshot {} is {}x{}, the sim is {}x{}", path, snapshot->Dims().x,
+                  snapshot->Dims().y, impl_->dims.x, impl_->dims.y);
+    return false;
+  }
+  // uploads straight from the mapping
+  SetGrid(snapshot->Cells());
+  impl_->tick = snapshot->Header().tick;
+  return true;
+}
+
+void SandSim::SetRules(SimRules rules) { impl_->SetRules(rules); }
+
+SimRules SandSim::GetRules() const { return impl_->rules; }
+
+CellFormat SandSim::GetCellFormat() const { return impl_->cell_format; }
+
+void SandSim::SetKernel(KernelVariant kernel) {
+  impl_->kernel = kernel;
+  impl_->kernels_dirty = true;
+}
+
+void SandSim::SetCpuKernel(CpuKernel kernel) {
+  impl_->cpu_kernel = kernel;
+  if (impl_->cpu_sim) {
+    impl_->SyncCpuSim();
+    impl_->cpu_sim->SetKernel(kernel);
+  }
+}
+
+bool SandSim::SetWorkGroupSize(const glm::ivec2& work_group_size) {
+  GLint max_invocations = 0;
+  glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &max_invocations);
+  if (work_group_size.x <= 0 || work_group_size.y <= 0 ||
+      work_group_size.x * work_group_size.y > max_invocations) {
+    spdlog::error("Unsupported work group size {}x{}", work_group_size.x, work_group_size.y);
+    impl_->work_group_size_input = impl_->work_group_size;
+    return false;
+  }
+  impl_->work_group_size = work_group_size;
+  impl_->UpdateKernelDefines();
+  // compiled right away, so a permutation that fails is reported here
+  return !impl_->UsesGl() || impl_->ResolveKernels();
+}
+
 bool SandSim::OnEvent(const SDL_Event& event) {
   return false;
   if (event.type == SDL_MOUSEBUTTONDOWN) {
-    auto pos = window_.GetMousePosition();
-    auto win_dims = window_.GetWindowSize();
+    auto pos = window_->GetMousePosition();
+    auto win_dims = window_->GetWindowSize();
     pos.y = win_dims.y - pos.y;
     // screen 1600,900
     glm::ivec2 true_pos = pos * impl_->dims / win_dims;
 
-    impl_->modifications.emplace_back(Modification{.x = true_pos.x,
-                                                   .y = true_pos.y,
-                                                   .radius = impl_->mod_radius,
-                                                   .shape = impl_->mod_shape,
-                                                   .cell = 1});
+    impl_->modifications.emplace_back(
+        Modification{.x = true_pos.x,
+                     .y = true_pos.y,
+                     .radius = impl_->mod_radius,
+                     .shape = impl_->mod_shape,
+                     .cell = static_cast<int>(impl_->mod_material)});
     return true;
   }
   return false;
@@ -142,7 +1147,152 @@ bool SandSim::OnEvent(const SDL_Event& event) {
 
 void SandSim::OnImGui() {
   ImGui::Begin("Sand");
-
+  int backend = static_cast<int>(impl_->backend);
+  bool changed = ImGui::RadioButton("GPU", &backend, static_cast<int>(SimBackend::kGpu));
+  ImGui::SameLine();
+  changed |= ImGui::RadioButton("CPU", &backend, static_cast<int>(SimBackend::kCpu));
+  if (changed) {
+    SetBackend(static_cast<SimBackend>(backend));
+  }
+  int rules = static_cast<int>(impl_->rules);
+  if (ImGui::RadioButton("Gather", &rules, static_cast<int>(SimRules::kGather))) {
+    SetRules(SimRules::kGather);
+  }
+  ImGui::SameLine();
+  if (ImGui::RadioButton("Margolus", &rules, static_cast<int>(SimRules::kMargolus))) {
+    SetRules(SimRules::kMargolus);
+  }
+  if (impl_->backend == SimBackend::kGpu) {
+    // Margolus has a single kernel
+    if (impl_->rules == SimRules::kGather) {
+      int kernel = static_cast<int>(impl_->kernel);
+      if (ImGui::RadioButton("Basic", &kernel, static_cast<int>(KernelVariant::kBasic))) {
+        SetKernel(KernelVariant::kBasic);
+      }
+      ImGui::SameLine();
+      if (ImGui::RadioButton("Tiled", &kernel, static_cast<int>(KernelVariant::kTiled))) {
+        SetKernel(KernelVariant::kTiled);
+      }
+    }
+    ImGui::Text("Cell format: %s", impl_->cell_format == CellFormat::kR8ui ? "R8UI" : "R32UI");
+    ImGui::InputInt("Work group x", &impl_->work_group_size_input.x);
+    ImGui::InputInt("Work group y", &impl_->work_group_size_input.y);
+    if (ImGui::Button("Apply work group size")) {
+      SetWorkGroupSize(impl_->work_group_size_input);
+    }
+    if (ImGui::CollapsingHeader("Statistics")) {
+      ImGui::Checkbox("Collect", &impl_->stats_enabled);
+      if (impl_->stats_data) impl_->PollStats();
+      const std::optional<SandSimImpl::StatsSample>& latest = impl_->stats_latest;
+      const std::optional<SandSimImpl::StatsSample>& previous = impl_->stats_previous;
+      if (latest.has_value()) {
+        ImGui::Text("At tick %lu", static_cast<unsigned long>(latest->tick));
+        // without edits in between, any change in a count is a conservation error
+        bool comparable = previous.has_value() && previous->edit_count == latest->edit_count;
+        for (const MaterialDef& def : kMaterials) {
+          auto m = static_cast<size_t>(def.type);
+          uint32_t count = latest->stats.material_counts[m];
+          int64_t drift = comparable ? static_cast<int64_t>(count) -
+                                           static_cast<int64_t>(previous->stats.material_counts[m])
+                                     : 0;
+          std::string name(def.name);
+          if (drift != 0) {
+            ImGui::TextColored(ImVec4(1, 0.3f, 0.3f, 1), "%s: %u (%+lld since tick %lu)",
+                               name.c_str(), count, static_cast<long long>(drift),
+                               static_cast<unsigned long>(previous->tick));
+          } else {
+            ImGui::Text("%s: %u", name.c_str(), count);
+          }
+        }
+        const DirtyRect& rect = latest->stats.changed_rect;
+        ImGui::Text("Changed by the last pass: %u", latest->stats.changed_cells);
+        if (!rect.Empty()) {
+          ImGui::Text("Activity: (%d, %d) to (%d, %d)", rect.min.x, rect.min.y, rect.max.x,
+                      rect.max.y);
+        }
+      }
+    }
+  }
+  if (impl_->backend == SimBackend::kCpu) {
+    int cpu_kernel = static_cast<int>(impl_->cpu_kernel);
+    if (ImGui::RadioButton("Bit-plane", &cpu_kernel, static_cast<int>(CpuKernel::kBitPlane))) {
+      SetCpuKernel(CpuKernel::kBitPlane);
+    }
+    ImGui::SameLine();
+    if (ImGui::RadioButton("Scalar", &cpu_kernel, static_cast<int>(CpuKernel::kScalar))) {
+      SetCpuKernel(CpuKernel::kScalar);
+    }
+    if (impl_->cpu_sim->UsesBitPlanes()) {
+      ImGui::Text("Bit-plane path: %s", BitPlanesUseAvx2() ? "AVX2" : "64-bit words");
+    }
+    ImGui::Text("Threads: %u", impl_->cpu_sim->NumThreads());
+    int num_chunks = impl_->num_chunks.x * impl_->num_chunks.y;
+    if (impl_->sim_thread) {
+      // the sim thread owns cpu_sim while it runs, its last frame is safe to read
+      const SimThread::Frame& frame = impl_->sim_thread->GetFrame();
+      ImGui::Text("Awake chunks: %u / %d", frame.awake_chunks, num_chunks);
+      ImGui::Text("Sim thread: drawing tick %lu, %lu jobs queued",
+                  static_cast<unsigned long>(frame.tick),
+                  static_cast<unsigned long>(impl_->sim_thread->NumPending()));
+    } else {
+      ImGui::Text("Awake chunks: %u / %d", impl_->cpu_sim->NumAwakeChunks(), num_chunks);
+    }
+  }
+  ImGui::Text("Tick: %lu", static_cast<unsigned long>(impl_->tick));
+  if (impl_->chunk_store) {
+    ImGui::Text("World origin: (%d, %d) chunks, arrow keys scroll", impl_->world_origin.x,
+                impl_->world_origin.y);
+    ImGui::Text("Resident: %d chunks, prefetched: %zu", impl_->num_chunks.x * impl_->num_chunks.y,
+                impl_->staged_chunks.size());
+    if (ImGui::Button("Save world")) SaveWorld();
+  }
+  ImGui::Text("Brush:");
+  for (const MaterialDef& def : kMaterials) {
+    ImGui::SameLine();
+    if (ImGui::RadioButton(std::string(def.name).c_str(), impl_->mod_material == def.type)) {
+      impl_->mod_material = def.type;
+    }
+  }
+  static char snapshot_path[256] = "world.snap";
+  ImGui::InputText("Snapshot", snapshot_path, sizeof(snapshot_path));
+  if (ImGui::Button("Save")) {
+    SaveSnapshot(snapshot_path);
+  }
+  ImGui::SameLine();
+  if (ImGui::Button("Load")) {
+    LoadSnapshot(snapshot_path);
+  }
+  static char input_log_path[256] = "input.log";
+  ImGui::InputText("Input log", input_log_path, sizeof(input_log_path));
+  if (impl_->recorder.IsOpen()) {
+    if (ImGui::Button("Stop recording")) StopRecording();
+  } else if (ImGui::Button("Record")) {
+    StartRecording(input_log_path);
+  }
+  ImGui::SameLine();
+  if (IsReplaying()) {
+    if (ImGui::Button("Stop replay")) StopReplay();
+  } else if (ImGui::Button("Replay")) {
+    StartReplay(input_log_path);
+  }
+  if (gl::GpuProfiler::IsInitialized() && ImGui::CollapsingHeader("GPU Timings")) {
+    gl::GpuProfiler& profiler = gl::GpuProfiler::Get();
+    for (const auto& scope : profiler.GetScopes()) {
+      std::string overlay = fmt::format("avg {:.3f} ms", scope.average_ms);
+      ImGui::PlotHistogram(scope.name.c_str(), scope.history_ms.data(),
+                           static_cast<int>(scope.history_ms.size()),
+                           static_cast<int>(scope.history_offset), overlay.c_str(), 0.f,
+                           std::max(scope.average_ms * 3.f, 0.01f), ImVec2(0, 60));
+    }
+    bool write_csv = profiler.IsWritingCsv();
+    if (ImGui::Checkbox("Write gpu_timings.csv", &write_csv)) {
+      if (write_csv) {
+        profiler.StartCsv("gpu_timings.csv");
+      } else {
+        profiler.StopCsv();
+      }
+    }
+  }
   ImGui::End();
 }
 }  // namespace sand
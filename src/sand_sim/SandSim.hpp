@@ -2,6 +2,11 @@
 
 #include <SDL_events.h>
 
+#include <filesystem>
+#include <span>
+
+#include "sand_sim/WorldGen.hpp"
+
 namespace gl {
 class Texture;
 }
@@ -9,21 +14,114 @@ namespace sand {
 
 class Window;
 struct SandSimImpl;
+struct Modification;
+
+enum class SimBackend { kGpu, kCpu };
+
+// GPU simulation kernel. kTiled stages each work group's cells and their neighbors in shared
+// memory before applying the rules.
+enum class KernelVariant { kBasic, kTiled };
+
+// CPU simulation kernel. kBitPlane stores the grid as 8 bit-planes and applies the rules to 64
+// cells per word, or 256 with AVX2. kScalar simulates one cell at a time.
+enum class CpuKernel { kBitPlane, kScalar };
+
+// Simulation rules. kGather moves cells straight down, one pass per tick, and is the only one
+// with a bit-plane CPU kernel. kMargolus rearranges 2x2 blocks in two passes per tick, which
+// adds diagonal slides and sideways flow.
+enum class SimRules { kGather, kMargolus };
+
+// Texture format of the GPU grid. Cells only use 8 bits, so kR8ui moves a quarter of the memory
+// of kR32ui per tick. The CPU grid and GetGrid() always use one uint32_t per cell.
+enum class CellFormat { kR8ui, kR32ui };
+
+struct SandSimCreateInfo {
+  glm::ivec2 dims;
+  glm::ivec2 work_group_size;
+  SimBackend backend{SimBackend::kGpu};
+  SimRules rules{SimRules::kMargolus};
+  KernelVariant kernel{KernelVariant::kBasic};
+  CellFormat cell_format{CellFormat::kR8ui};
+  CpuKernel cpu_kernel{CpuKernel::kBitPlane};
+  // 0 uses one thread per hardware thread
+  uint32_t num_threads{0};
+  // Steps the CPU backend on its own thread, see SimThread. Simulate then only queues the ticks
+  // and draws the newest grid the thread finished.
+  bool sim_thread{false};
+  // Skips everything only needed for drawing. A headless CPU sim makes no GL calls at all.
+  bool headless{false};
+  // Makes the grid a window of resident chunks onto an unbounded world stored in world_dir, see
+  // ScrollWorld. dims must then be whole chunks. Empty keeps a fixed board.
+  std::filesystem::path world_dir{};
+  // Starting board, DefaultWorld(dims) if unset. A streamed world generates every chunk it never
+  // saved from it, in world cells.
+  std::optional<WorldGenDesc> world_gen{};
+};
 
 class SandSim {
  public:
+  // headless, without brush input
+  SandSim();
   explicit SandSim(const Window& window);
   // default for pimpl
   ~SandSim();
-  void Start(const glm::ivec2& dims, const glm::ivec2& work_group_size);
-  void Simulate() const;
+  void Start(const SandSimCreateInfo& create_info);
+  // Runs num_ticks ticks. On the GPU they are queued back to back without waiting on the CPU,
+  // followed by the statistics reduction shown in OnImGui unless it is turned off there.
+  void Simulate(uint32_t num_ticks = 1) const;
   void Update();
   bool OnEvent(const SDL_Event& event);
   void OnImGui();
+  // Replaces the grid and wakes every chunk.
+  void SetGrid(std::span<const uint32_t> grid);
+  // Replaces the grid with a generated one and wakes every chunk. On the GPU the cells are
+  // written by a compute pass or a clear, without a board sized upload.
+  void Generate(const WorldGenDesc& desc);
+  // Queues a brush edit for the next Simulate().
+  void AddModification(const Modification& modification);
+  // Switches backends, carrying the current grid over to the new one.
+  void SetBackend(SimBackend backend);
+  [[nodiscard]] SimBackend GetBackend() const;
+  // Switches rules between ticks. Wakes every chunk.
+  void SetRules(SimRules rules);
+  [[nodiscard]] SimRules GetRules() const;
+  [[nodiscard]] CellFormat GetCellFormat() const;
+  void SetKernel(KernelVariant kernel);
+  void SetCpuKernel(CpuKernel kernel);
+  // Recompiles the GPU kernels for the new size. Returns false, keeping the previous size, if the
+  // size is unsupported or its kernels fail to compile.
+  bool SetWorkGroupSize(const glm::ivec2& work_group_size);
+  // Reads back the most recently simulated grid, row major with y = 0 at the bottom.
+  [[nodiscard]] std::vector<uint32_t> GetGrid() const;
+  [[nodiscard]] glm::ivec2 GetDims() const;
+  // Number of ticks simulated since Start, or since the tick of the last loaded snapshot.
+  [[nodiscard]] uint64_t GetTick() const;
+  // Writes the most recently simulated grid and the tick to path. See Snapshot.hpp for the format.
+  bool SaveSnapshot(const std::string& path) const;
+  // Replaces the grid and tick with those of a snapshot with the same dims.
+  bool LoadSnapshot(const std::string& path);
+  // Logs every modification applied from now on with its tick. See InputLog.hpp for the format.
+  bool StartRecording(const std::string& path);
+  void StopRecording();
+  // Feeds a recorded log back in on the recorded ticks. Live brush input is ignored until the log
+  // runs out or StopReplay() is called.
+  bool StartReplay(const std::string& path);
+  void StopReplay();
+  [[nodiscard]] bool IsReplaying() const;
+  // Moves the window onto the world by delta chunks. Chunks leaving it are written to the world
+  // store in the background, chunks entering it are read back, usually already prefetched. On the
+  // GPU only those chunks cross the bus, the rest are copied within the textures. Does nothing
+  // without a world_dir.
+  void ScrollWorld(glm::ivec2 delta);
+  // Queues writing every resident chunk to the world store.
+  void SaveWorld() const;
   [[nodiscard]] const gl::Texture& GetCurrTex() const;
 
-  const Window& window_;
+  const Window* window_{nullptr};
   // pimpl
   std::unique_ptr<SandSimImpl> impl_{nullptr};
+
+ private:
+  void SimulateTicks(uint32_t num_ticks) const;
 };
 }  // namespace sand
@@ -0,0 +1,86 @@
+#include "Scenario.hpp"
+
+namespace sand {
+
+namespace {
+
+constexpr uint32_t kSand = static_cast<uint32_t>(MaterialType::kSand);
+constexpr uint32_t kWater = static_cast<uint32_t>(MaterialType::kWater);
+
+// fixed seed so every run of a scenario starts from the same grid
+uint32_t XorShift(uint32_t& state) {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+void NoModifications(uint32_t, const glm::ivec2&, std::vector<Modification>&) {}
+
+void FillRows(std::vector<uint32_t>& grid, const glm::ivec2& dims, int y_begin, int y_end,
+              uint32_t cell = kSand) {
+  std::fill(grid.begin() + static_cast<size_t>(y_begin) * dims.x,
+            grid.begin() + static_cast<size_t>(y_end) * dims.x, cell);
+}
+
+// same board SandSim::Start builds: one row of sand just below the top
+void InitSandRow(std::vector<uint32_t>& grid, const glm::ivec2& dims) {
+  FillRows(grid, dims, dims.y - 2, dims.y - 1);
+}
+
+void InitFill(std::vector<uint32_t>& grid, const glm::ivec2& dims) {
+  FillRows(grid, dims, dims.y / 2, dims.y);
+}
+
+void InitNoise(std::vector<uint32_t>& grid, const glm::ivec2&) {
+  uint32_t state = 0x12345678;
+  for (uint32_t& cell : grid) {
+    if (XorShift(state) % 4 == 0) cell = kSand;
+  }
+}
+
+void InitSettled(std::vector<uint32_t>& grid, const glm::ivec2& dims) {
+  FillRows(grid, dims, 0, dims.y / 4);
+}
+
+void InitLayers(std::vector<uint32_t>& grid, const glm::ivec2& dims) {
+  FillRows(grid, dims, 0, dims.y / 4, kWater);
+  FillRows(grid, dims, dims.y / 4, dims.y / 2);
+}
+
+void InitEmpty(std::vector<uint32_t>&, const glm::ivec2&) {}
+
+void RainModifications(uint32_t tick, const glm::ivec2& dims, std::vector<Modification>& out) {
+  constexpr int kDropsPerTick = 16;
+  for (int i = 0; i < kDropsPerTick; i++) {
+    out.emplace_back(Modification{.x = static_cast<int>((tick * 37 + i * 101) % dims.x),
+                                  .y = dims.y - 4,
+                                  .radius = 9,
+                                  .shape = ModificationShape::kCircle,
+                                  .cell = static_cast<int>(kSand)});
+  }
+}
+
+constexpr Scenario kScenarios[] = {
+    {"sand_row", "the default board, a single row of sand falling", InitSandRow, NoModifications},
+    {"fill", "top half solid sand, everything falls at once", InitFill, NoModifications},
+    {"noise", "25% random sand spread over the whole board", InitNoise, NoModifications},
+    {"settled", "bottom quarter sand that never moves", InitSettled, NoModifications},
+    {"layers", "bottom quarter water under a quarter of sand that sinks through it", InitLayers,
+     NoModifications},
+    {"rain", "empty board with 16 brushes of sand added every tick", InitEmpty,
+     RainModifications},
+};
+
+}  // namespace
+
+std::span<const Scenario> GetScenarios() { return kScenarios; }
+
+const Scenario* FindScenario(std::string_view name) {
+  for (const Scenario& scenario : kScenarios) {
+    if (scenario.name == name) return &scenario;
+  }
+  return nullptr;
+}
+
+}  // namespace sand
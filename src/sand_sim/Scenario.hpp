@@ -0,0 +1,23 @@
+#pragma once
+
+#include <span>
+
+#include "sand_sim/Cell.hpp"
+
+namespace sand {
+
+// Named, deterministic workload: a starting grid plus a fixed schedule of brush edits.
+struct Scenario {
+  std::string_view name;
+  std::string_view description;
+  // Fills the starting grid, which is passed in zeroed and sized to dims.
+  void (*init)(std::vector<uint32_t>& grid, const glm::ivec2& dims);
+  // Appends the brush edits applied before the given tick.
+  void (*modifications)(uint32_t tick, const glm::ivec2& dims, std::vector<Modification>& out);
+};
+
+std::span<const Scenario> GetScenarios();
+// nullptr if no scenario has the given name
+const Scenario* FindScenario(std::string_view name);
+
+}  // namespace sand
@@ -0,0 +1,57 @@
+#include "SimThread.hpp"
+
+#include "sand_sim/CpuSim.hpp"
+
+namespace sand {
+
+SimThread::SimThread(CpuSim& sim) : sim_(sim), thread_(&SimThread::Loop, this) {}
+
+SimThread::~SimThread() {
+  Sync();
+  stop_.store(true);
+  // wakes the loop without a job
+  submitted_.fetch_add(1);
+  submitted_.notify_one();
+  thread_.join();
+}
+
+void SimThread::Submit(Job job) {
+  while (!jobs_.TryPush(std::move(job))) {
+    // full, wait for a job to finish
+    uint64_t completed = completed_.load();
+    if (submitted_.load() - completed >= kQueueCapacity - 1) completed_.wait(completed);
+  }
+  submitted_.fetch_add(1);
+  submitted_.notify_one();
+}
+
+void SimThread::Sync() {
+  uint64_t submitted = submitted_.load();
+  for (uint64_t completed = completed_.load(); completed != submitted;
+       completed = completed_.load()) {
+    completed_.wait(completed);
+  }
+}
+
+void SimThread::Loop() {
+  const std::vector<Modification> no_modifications;
+  uint64_t completed = 0;
+  while (true) {
+    submitted_.wait(completed);
+    if (stop_.load()) return;
+    std::optional<Job> job = jobs_.TryPop();
+    EASSERT_MSG(job.has_value(), "Job was counted before it was pushed");
+    for (uint32_t i = 0; i < job->num_ticks; i++) {
+      sim_.Step(i == 0 ? job->modifications : no_modifications, job->first_tick + i);
+    }
+    Frame& frame = frames_.WriteBuffer();
+    frame.grid = sim_.GetGrid();
+    frame.tick = job->first_tick + job->num_ticks;
+    frame.awake_chunks = sim_.NumAwakeChunks();
+    frames_.Publish();
+    completed = completed_.fetch_add(1) + 1;
+    completed_.notify_all();
+  }
+}
+
+}  // namespace sand
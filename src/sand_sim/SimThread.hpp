@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+#include "SpscQueue.hpp"
+#include "TripleBuffer.hpp"
+#include "sand_sim/Cell.hpp"
+
+namespace sand {
+
+class CpuSim;
+
+// Steps a CpuSim on a dedicated thread, so a slow tick never holds up input or presentation.
+// Jobs and the brush edits they carry arrive through an SPSC queue and run in submission order.
+// Each finished job publishes the grid through a triple buffer, so the render thread always
+// draws the newest one without waiting.
+class SimThread {
+ public:
+  struct Job {
+    uint64_t first_tick;
+    uint32_t num_ticks;
+    // applied on the first tick
+    std::vector<Modification> modifications;
+  };
+  struct Frame {
+    std::vector<uint32_t> grid;
+    // ticks simulated so far
+    uint64_t tick{0};
+    uint32_t awake_chunks{0};
+  };
+
+  explicit SimThread(CpuSim& sim);
+  SimThread(const SimThread& other) = delete;
+  SimThread& operator=(const SimThread& other) = delete;
+  // Finishes the submitted jobs first.
+  ~SimThread();
+
+  // Blocks only if the queue is full.
+  void Submit(Job job);
+  // Jobs submitted but not finished.
+  [[nodiscard]] uint64_t NumPending() const {
+    return submitted_.load(std::memory_order_relaxed) - completed_.load(std::memory_order_relaxed);
+  }
+  // Blocks until every submitted job has finished. The CpuSim may then be used from the
+  // submitting thread until the next Submit.
+  void Sync();
+  // Switches GetFrame to the newest finished frame. Returns false if there is none since the last
+  // call.
+  bool TakeFrame() { return frames_.Consume(); }
+  [[nodiscard]] const Frame& GetFrame() const { return frames_.ReadBuffer(); }
+
+ private:
+  void Loop();
+
+  static constexpr size_t kQueueCapacity = 16;
+
+  CpuSim& sim_;
+  SpscQueue<Job, kQueueCapacity> jobs_;
+  TripleBuffer<Frame> frames_;
+  std::atomic<uint64_t> submitted_{0};
+  std::atomic<uint64_t> completed_{0};
+  std::atomic<bool> stop_{false};
+  std::thread thread_;
+};
+
+}  // namespace sand
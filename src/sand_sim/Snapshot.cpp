@@ -0,0 +1,132 @@
+#include "Snapshot.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+
+namespace sand {
+
+namespace {
+
+#ifdef MAP_POPULATE
+// the whole file is read right away by the upload, so fault it in up front
+constexpr int kMapFlags = MAP_PRIVATE | MAP_POPULATE;
+#else
+constexpr int kMapFlags = MAP_PRIVATE;
+#endif
+
+size_t CellBytes(const SnapshotHeader& header) {
+  return static_cast<size_t>(header.width) * header.height * sizeof(uint32_t);
+}
+
+}  // namespace
+
+std::optional<MappedSnapshot> MappedSnapshot::Open(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    spdlog::error("Failed to open snapshot {}", path);
+    return std::nullopt;
+  }
+  struct stat st {};
+  if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(SnapshotHeader)) {
+    spdlog::error("Snapshot {} is too small", path);
+    close(fd);
+    return std::nullopt;
+  }
+  MappedSnapshot snapshot;
+  snapshot.size_ = static_cast<size_t>(st.st_size);
+  void* data = mmap(nullptr, snapshot.size_, PROT_READ, kMapFlags, fd, 0);
+  // the mapping keeps the file alive
+  close(fd);
+  if (data == MAP_FAILED) {
+    spdlog::error("Failed to map snapshot {}", path);
+    return std::nullopt;
+  }
+  snapshot.data_ = data;
+
+  const SnapshotHeader& header = snapshot.Header();
+  if (header.magic != kSnapshotMagic) {
+    spdlog::error("{} is not a snapshot", path);
+    return std::nullopt;
+  }
+  if (header.version != kSnapshotVersion) {
+    spdlog::error("Snapshot {} has version {}, expected {}", path, header.version,
+                  kSnapshotVersion);
+    return std::nullopt;
+  }
+  if (header.cell_encoding != CellEncoding::kR32ui) {
+    spdlog::error("Snapshot {} has unknown cell encoding {}", path,
+                  static_cast<uint32_t>(header.cell_encoding));
+    return std::nullopt;
+  }
+  if (header.width <= 0 || header.height <= 0 || header.data_offset < sizeof(SnapshotHeader) ||
+      header.data_offset % alignof(uint32_t) != 0 || header.data_offset > snapshot.size_ ||
+      snapshot.size_ - header.data_offset < CellBytes(header)) {
+    spdlog::error("Snapshot {} is truncated or corrupt", path);
+    return std::nullopt;
+  }
+  return snapshot;
+}
+
+MappedSnapshot::MappedSnapshot(MappedSnapshot&& other) noexcept { *this = std::move(other); }
+
+MappedSnapshot& MappedSnapshot::operator=(MappedSnapshot&& other) noexcept {
+  if (&other == this) return *this;
+  this->~MappedSnapshot();
+  data_ = std::exchange(other.data_, nullptr);
+  size_ = std::exchange(other.size_, 0);
+  return *this;
+}
+
+MappedSnapshot::~MappedSnapshot() {
+  if (data_) munmap(data_, size_);
+  data_ = nullptr;
+}
+
+std::span<const uint32_t> MappedSnapshot::Cells() const {
+  const SnapshotHeader& header = Header();
+  return {reinterpret_cast<const uint32_t*>(static_cast<const std::byte*>(data_) +
+                                            header.data_offset),
+          static_cast<size_t>(header.width) * header.height};
+}
+
+SnapshotWriter::~SnapshotWriter() {
+  if (file_) std::fclose(file_);
+}
+
+bool SnapshotWriter::Open(const std::string& path, const SnapshotHeader& header) {
+  EASSERT_MSG(!file_, "SnapshotWriter is already open");
+  path_ = path;
+  file_ = std::fopen(path.c_str(), "wb");
+  if (!file_) {
+    spdlog::error("Failed to open {} for writing", path);
+    return false;
+  }
+  std::vector<std::byte> start(header.data_offset);
+  std::memcpy(start.data(), &header, sizeof(header));
+  return Write(start.data(), start.size());
+}
+
+bool SnapshotWriter::Write(const void* data, size_t size_bytes) {
+  if (!file_) return false;
+  if (std::fwrite(data, 1, size_bytes, file_) != size_bytes) {
+    spdlog::error("Failed to write snapshot {}", path_);
+    std::fclose(file_);
+    file_ = nullptr;
+    return false;
+  }
+  return true;
+}
+
+bool SnapshotWriter::Close() {
+  if (!file_) return false;
+  bool ok = std::fclose(file_) == 0;
+  file_ = nullptr;
+  if (!ok) spdlog::error("Failed to write snapshot {}", path_);
+  return ok;
+}
+
+}  // namespace sand
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdio>
+#include <span>
+
+namespace sand {
+
+// How cells are stored in a snapshot.
+enum class CellEncoding : uint32_t {
+  // one CellData::Pack value per uint32_t, the layout returned by SandSim::GetGrid
+  kR32ui = 0,
+};
+
+constexpr uint32_t kSnapshotMagic = 0x444e4153;  // "SAND"
+constexpr uint32_t kSnapshotVersion = 1;
+// Cell data starts on a page boundary so a mapping of the file can be handed straight to GL.
+constexpr uint32_t kSnapshotDataAlignment = 4096;
+
+// Start of every snapshot file. The cells follow at data_offset, row major with y = 0 at the
+// bottom.
+struct SnapshotHeader {
+  uint32_t magic{kSnapshotMagic};
+  uint32_t version{kSnapshotVersion};
+  int32_t width{0};
+  int32_t height{0};
+  CellEncoding cell_encoding{CellEncoding::kR32ui};
+  uint32_t data_offset{kSnapshotDataAlignment};
+  uint64_t tick{0};
+};
+static_assert(sizeof(SnapshotHeader) == 32, "SnapshotHeader is written to disk as is");
+
+// Read-only mapping of a snapshot file. Cells() points into the mapping, so nothing is copied
+// until the cells are uploaded.
+class MappedSnapshot {
+ public:
+  // Logs and returns nullopt if the file can't be mapped or isn't a valid snapshot.
+  static std::optional<MappedSnapshot> Open(const std::string& path);
+  MappedSnapshot(const MappedSnapshot& other) = delete;
+  MappedSnapshot& operator=(const MappedSnapshot& other) = delete;
+  MappedSnapshot(MappedSnapshot&& other) noexcept;
+  MappedSnapshot& operator=(MappedSnapshot&& other) noexcept;
+  ~MappedSnapshot();
+
+  [[nodiscard]] const SnapshotHeader& Header() const {
+    return *static_cast<const SnapshotHeader*>(data_);
+  }
+  [[nodiscard]] glm::ivec2 Dims() const { return {Header().width, Header().height}; }
+  [[nodiscard]] std::span<const uint32_t> Cells() const;
+
+ private:
+  MappedSnapshot() = default;
+  void* data_{nullptr};
+  size_t size_{0};
+};
+
+// Writes a snapshot front to back: the header and padding on Open, then the cells in any number
+// of Write calls.
+class SnapshotWriter {
+ public:
+  SnapshotWriter() = default;
+  SnapshotWriter(const SnapshotWriter& other) = delete;
+  SnapshotWriter& operator=(const SnapshotWriter& other) = delete;
+  ~SnapshotWriter();
+
+  bool Open(const std::string& path, const SnapshotHeader& header);
+  bool Write(const void* data, size_t size_bytes);
+  // Returns false if any write failed.
+  bool Close();
+
+ private:
+  std::FILE* file_{nullptr};
+  std::string path_;
+};
+
+}  // namespace sand
@@ -0,0 +1,16 @@
+#include "WorldGen.hpp"
+
+namespace sand {
+
+std::vector<uint32_t> GenerateWorld(const WorldGenDesc& desc, const glm::ivec2& dims) {
+  EASSERT_MSG(desc.layers.size() <= kMaxWorldGenLayers, "Too many world gen layers");
+  EASSERT_MSG(desc.feature_size > 0 && desc.amplitude >= 0, "Invalid terrain shape");
+  std::vector<uint32_t> grid;
+  grid.reserve(static_cast<size_t>(dims.x) * dims.y);
+  for (int y = 0; y < dims.y; y++) {
+    for (int x = 0; x < dims.x; x++) grid.emplace_back(WorldGenCell(desc, {x, y}));
+  }
+  return grid;
+}
+
+}  // namespace sand
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <span>
+
+#include "sand_sim/Rules.hpp"
+
+namespace sand {
+
+// What SandSim::Generate fills the board with.
+enum class WorldGenKind : uint32_t {
+  // every cell is material, cleared without a dispatch on the GPU
+  kFill,
+  // horizontal bands of layers over empty cells
+  kStrata,
+  // rolling ground of material, with fluid filling the valleys up to fluid_level
+  kTerrain,
+  // material scattered over empty cells with a chance of density out of 256 per cell
+  kScatter,
+};
+
+// Rows [y_begin, y_end) of material.
+struct WorldGenLayer {
+  MaterialType material;
+  int y_begin;
+  int y_end;
+};
+
+// Most layers of a kStrata descriptor, the size of the array in worldgen.cs.glsl.
+constexpr size_t kMaxWorldGenLayers = 8;
+
+// A board described in a few bytes, generated straight into the GPU textures. Each kind only
+// reads its own fields. Generation is integer only, so both backends build the same cells.
+struct WorldGenDesc {
+  WorldGenKind kind{WorldGenKind::kFill};
+  MaterialType material{MaterialType::kNone};
+  uint32_t seed{0};
+  // kStrata, later layers over earlier ones
+  std::vector<WorldGenLayer> layers{};
+  // kTerrain: ground height around base_height, off by up to amplitude over feature_size columns
+  // plus a quarter of that over a quarter of the width
+  int base_height{0};
+  int amplitude{0};
+  int feature_size{64};
+  MaterialType fluid{MaterialType::kNone};
+  int fluid_level{0};
+  // kScatter
+  uint32_t density{0};
+};
+
+// The board SandSim starts with: one row of sand just below the top.
+inline WorldGenDesc DefaultWorld(const glm::ivec2& dims) {
+  WorldGenLayer sand_row{.material = MaterialType::kSand, .y_begin = dims.y - 2,
+                         .y_end = dims.y - 1};
+  return {.kind = WorldGenKind::kStrata, .layers = {sand_row}};
+}
+
+// Height offset in [-amplitude, amplitude] of 1D value noise with a random height every period
+// columns, linearly interpolated. Must match value_noise() in worldgen.cs.glsl for x >= 0, the
+// only columns the GPU generates. Streamed worlds also generate chunks left of the origin here,
+// so i rounds down.
+inline int ValueNoise(int x, int period, int amplitude, uint32_t seed) {
+  auto lattice = [&](int i) {
+    uint32_t bits = RandomBits(seed, static_cast<uint32_t>(i));
+    return static_cast<int>(RandomBelow(bits, static_cast<uint32_t>(2 * amplitude + 1)));
+  };
+  int i = x / period - (x % period < 0 ? 1 : 0);
+  int t = x - i * period;
+  return (lattice(i) * (period - t) + lattice(i + 1) * t) / period - amplitude;
+}
+
+// The packed cell at pos. Must match generate() in worldgen.cs.glsl.
+inline uint32_t WorldGenCell(const WorldGenDesc& desc, glm::ivec2 pos) {
+  MaterialType material = MaterialType::kNone;
+  switch (desc.kind) {
+    case WorldGenKind::kFill:
+      material = desc.material;
+      break;
+    case WorldGenKind::kStrata:
+      for (const WorldGenLayer& layer : desc.layers) {
+        if (pos.y >= layer.y_begin && pos.y < layer.y_end) material = layer.material;
+      }
+      break;
+    case WorldGenKind::kTerrain: {
+      int height = desc.base_height +
+                   ValueNoise(pos.x, desc.feature_size, desc.amplitude, desc.seed) +
+                   ValueNoise(pos.x, std::max(desc.feature_size / 4, 1), desc.amplitude / 4,
+                              Hash(desc.seed));
+      if (pos.y < height) {
+        material = desc.material;
+      } else if (pos.y < desc.fluid_level) {
+        material = desc.fluid;
+      }
+      break;
+    }
+    case WorldGenKind::kScatter: {
+      if ((RandomBits(desc.seed, pos) & 0xff) < desc.density) material = desc.material;
+      break;
+    }
+  }
+  return CellData::Pack(material, 0);
+}
+
+// Generates the whole board of dims on the CPU, the reference for the GPU generator.
+std::vector<uint32_t> GenerateWorld(const WorldGenDesc& desc, const glm::ivec2& dims);
+
+}  // namespace sand